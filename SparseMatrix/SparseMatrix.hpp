@@ -6,9 +6,33 @@
 //  Copyright © 2016 Jonathan Cardasis. All rights reserved.
 //
 //  Contained Classes/Structs:
-//    + Element (Struct)
-//    + ElementList (Class)
-//    + SparseMatrix (Class)
+//    + BasicElement (Struct Template), Element
+//    + Instrumentation (Class)
+//    + BasicElementPool (Class Template), ElementPool
+//    + BasicRowIndex (Class Template)
+//    + BasicElementList (Class Template), ElementList
+//    + MappedFile (Class)
+//    + CompressedArray (Class Template)
+//    + BasicCompressedStorage (Struct Template), CompressedStorage
+//    + BasicRowView (Class Template), RowView
+//    + BasicRowReference (Class Template), RowReference
+//    + WorkerPool (Class)
+//    + BasicTriplet (Struct Template), Triplet
+//    + ScalarLane, Avx2Lane, Avx512Lane, BlockLane, BlockKernel, PanelKernel, RowDotKernel (Struct Templates)
+//    + BlockShape (Struct)
+//    + MatrixExpression, MatrixProduct, MatrixSum, MatrixScaled, MatrixTranspose (Struct Templates)
+//    + PlusTimes, MinPlus, MaxTimes, OrAnd (Struct Templates)
+//    + BasicReordering (Struct Template), Reordering
+//    + BasicSparseMatrix (Class Template), SparseMatrix
+//    + BasicBlockSparseMatrix (Class Template), BlockSparseMatrix<R, C>
+//    + BasicSellMatrix (Class Template), SellMatrix<C>
+//    + BasicMultiplyPlan (Class Template), MultiplyPlan
+//    + BasicDeltaMatrix (Class Template), DeltaMatrix
+//    + BasicVersionedMatrix (Class Template), VersionedMatrix
+//
+//  The templates take the value type and the index type used for rows and columns,
+//  for example BasicSparseMatrix<float, int> or BasicSparseMatrix<double, long long>.
+//  The plain names are typedefs for the double valued, int indexed versions.
 //
 //  Purpose:
 //  This code creates a SparseMatrix, or a matrix in which only the locations
@@ -22,7 +46,9 @@
 //    an Element stuct which contains a value and the column location it should exist at.
 //
 //  Each row in the SparseMatrix is an ElementList object, which is a linked list
-//  containing Element objects.
+//  containing Element objects. A SparseMatrix which is mostly read can be frozen with
+//  freeze(), which moves its Elements into contiguous compressed sparse row arrays
+//  (CompressedStorage), and thawed back into ElementLists with thaw() before editing.
 //
 //  Input:
 //  + A SparseMatrix's value at a location can be set using matrix[row][col] = value
@@ -30,8 +56,23 @@
 //  + To access the values of an ElementList or SparseMatrix an example would be list[col]
 //    or matrix[row][col] respectively.
 //
+//  + delta.update(row, col, value) records a write to a DeltaMatrix in a per-thread log, merged into
+//    its frozen matrix in sorted batches.
+//  + versioned.set(row, col, value) and versioned.publish() install new row versions of a VersionedMatrix,
+//    which other threads read through versioned.snapshot() without locking.
+//  + matrix.readMatrixMarket(path) loads a Matrix Market coordinate file.
+//  + matrix.mapBinary(path) opens a file saved by writeBinary as a frozen matrix without copying it.
+//
 //  Output:
 //  + A SparseMatrix as well as an ElementList can be printed using the << operator.
+//  + a*b, a+b, a-b, alpha*a and a.tr() are lazy expressions, computed in one fused pass when they are
+//    assigned to a SparseMatrix.
+//  + matrix.writeMatrixMarket(path) saves the stored Elements as a Matrix Market coordinate file.
+//  + matrix.writeBinary(path) saves the matrix as compressed sparse row arrays behind a 64 byte header.
+//  + matrix.spmv(y, x, alpha, beta) computes y = alpha*matrix*x + beta*y for dense arrays x and y,
+//    using the threads of the shared WorkerPool.
+//  + matrix.spmm(y, x, k, alpha, beta) does the same for row-major dense matrices x and y of k columns.
+//  + a.maskedProduct(b, mask, mode) computes a*b only at the positions the mask selects.
 //
 
 
@@ -40,582 +81,7168 @@
 
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <type_traits>
+#include <cctype>
+#include <cstring>
+#include <cstdint>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 using namespace std;
 
 
-struct Element {
-    int col;
-    double value;
-    Element *next;
-    Element(int c= -1, double v=0., Element *nxt=nullptr){
+/*
+Every type below is a template over the value type T and the index type Index used for row and
+column numbers. The typedefs after each one (Element, ElementList, SparseMatrix, ...) give the
+double valued, int indexed versions the library has always provided.
+*/
+template <class T, class Index> class BasicSparseMatrix;
+typedef BasicSparseMatrix<double, int> SparseMatrix;
+template <class T, class Index, int R, int C> class BasicBlockSparseMatrix;
+template <int R, int C> using BlockSparseMatrix = BasicBlockSparseMatrix<double, int, R, C>;
+template <class T, class Index, int C> class BasicSellMatrix;
+template <int C> using SellMatrix = BasicSellMatrix<double, int, C>;
+template <class T, class Index> class BasicMultiplyPlan;
+typedef BasicMultiplyPlan<double, int> MultiplyPlan;
+template <class T, class Index> class BasicDeltaMatrix;
+typedef BasicDeltaMatrix<double, int> DeltaMatrix;
+template <class T, class Index> class BasicVersionedMatrix;
+typedef BasicVersionedMatrix<double, int> VersionedMatrix;
+
+template <class T, class Index>
+struct BasicElement {
+    Index col;
+    T value;
+    BasicElement *next;
+    BasicElement(Index c= -1, T v=T(), BasicElement *nxt=nullptr){
         col = c;
         value = v;
         next = nxt;
     }
-    void operator = (double v){
+    void operator = (T v){
         value = v;
     }
-    friend ostream &operator << (ostream &out, Element e);
 };
 
+typedef BasicElement<double, int> Element;
+
 /*
 Prints out an Element's value
 Post: returns an ostream with the Element's value
 */
-ostream &operator << (ostream &out, Element e){
-    out << e.value;
+template <class T, class Index>
+ostream &operator << (ostream &out, const BasicElement<T, Index> &e){
+    out << +e.value; //Unary plus prints char sized integers as numbers
     return out;
 }
 
 
-//MARK: ElementList
-class ElementList{
+//MARK: Instrumentation
+/*
+Counters and timers showing where a program's time in the library goes, switched on by defining
+SPARSEMATRIX_INSTRUMENT before including this file. Without it SPARSEMATRIX_COUNT and SPARSEMATRIX_TIME
+expand to nothing, so the library is built exactly as if they were not there and every snapshot is zero.
+
+Every thread adds to its own counters, which only it writes, so counting takes no locks and shares no
+cache lines. snapshot() adds up the counters of every thread, including threads which have exited.
+Counters only grow: subtract an earlier snapshot from a later one to see what happened in between.
+Operation times are inclusive, so the time of a + b*c also holds the time of the multiply inside it.
+*/
+#ifdef SPARSEMATRIX_INSTRUMENT
+#define SPARSEMATRIX_COUNT(counter, amount) Instrumentation::add(Instrumentation::counter, (amount))
+#define SPARSEMATRIX_TIME(operation) Instrumentation::ScopedTimer instrumentationTimer(Instrumentation::operation)
+#else
+#define SPARSEMATRIX_COUNT(counter, amount) ((void)sizeof(amount)) //Never evaluated
+#define SPARSEMATRIX_TIME(operation) ((void)0)
+#endif
+
+class Instrumentation {
 public:
+    enum Counter {
+        ElementAllocations, //Elements created in ElementLists
+        ElementFrees,       //Elements released from ElementLists
+        NodesTraversed,     //Elements stepped over while looking up a column with getIth or []
+        NonZerosInserted,   //Elements linked into an existing row by [], +=, -= or axpy
+        Flops,              //Multiplies and adds done by matrix multiplication
+        numCounters
+    };
     
-/* ---Constructors and Destructors--- */
-    ElementList(const int max=0){
-        maxCols = max;
-        list = nullptr;
-    }
+    enum Operation {
+        Transpose, //Evaluating a tr() expression
+        Multiply,  //Each product kernel run, fused or not
+        Add,       //Evaluating a sum expression, or += and -= on a matrix
+        Assign,    //Copy assignment of a matrix
+        Copy,      //Copy construction of a matrix
+        numOperations
+    };
     
-    ElementList(const ElementList &rhs){ //Deep Copy Constructor
-        maxCols = rhs.maxCols;
-        list = rhs.list;
-        if(list != nullptr){
-            list = new Element(rhs.list->col, rhs.list->value, rhs.list->next);
-            Element *leftPtr = list;
-            Element *rightPtr = rhs.list;
-            
-            while(rightPtr->next != nullptr){
-                Element *elementToCopy = rightPtr->next;
-                leftPtr->next = new Element(elementToCopy->col, elementToCopy->value, elementToCopy->next);
-                
-                leftPtr = leftPtr->next;
-                rightPtr = rightPtr->next;
+    /*
+    The totals of every counter and, for each operation, how often it ran and for how long.
+    */
+    struct Snapshot {
+        uint64_t counters[numCounters];
+        uint64_t calls[numOperations];
+        uint64_t nanoseconds[numOperations];
+        
+        Snapshot(){
+            fill(counters, counters + numCounters, 0);
+            fill(calls, calls + numOperations, 0);
+            fill(nanoseconds, nanoseconds + numOperations, 0);
+        }
+        
+        /*
+        Post: returns what happened between the earlier snapshot rhs and this one.
+        */
+        Snapshot operator - (const Snapshot &rhs) const {
+            Snapshot difference;
+            for(int i=0; i < numCounters; i++){
+                difference.counters[i] = counters[i] - rhs.counters[i];
+            }
+            for(int i=0; i < numOperations; i++){
+                difference.calls[i] = calls[i] - rhs.calls[i];
+                difference.nanoseconds[i] = nanoseconds[i] - rhs.nanoseconds[i];
             }
+            return difference;
         }
-    }
-    
-    ~ElementList(){ //Destructor
-        deleteList(list);
-    }
+    };
     
 /* ---Accessors and Mutators--- */
     
     /*
-    Sets the how many columns an ElementList should have.
-    Post: the ElementList will contain the number of max afterwards. The list variable is also set to nullptr
+    Post: returns true if the library was compiled with SPARSEMATRIX_INSTRUMENT.
     */
-    void set(int max){
-        list = nullptr;
-        maxCols = max;
+    static bool enabled(){
+#ifdef SPARSEMATRIX_INSTRUMENT
+        return true;
+#else
+        return false;
+#endif
     }
     
     
     /*
-    Post: returns the first Element in the ElementList.
+    Post: returns the totals of the counters of every thread which has counted anything so far.
     */
-    Element *& getList(){
-        return list;
+    static Snapshot snapshot(){
+        Registry &all = registry();
+        lock_guard<mutex> guard(all.lock);
+        Snapshot totals;
+        all.retired.addTo(totals);
+        for(size_t i=0; i < all.live.size(); i++){
+            all.live[i]->addTo(totals);
+        }
+        return totals;
     }
     
     
     /*
-    Post: Returns the value of the list at column i. If no Element exists at column, zero is returned.
+    Post: the calling thread's counter has grown by amount.
     */
-    double getIth(int i){
-        Element *ptr = list;
-        for(int j=0; j<maxCols && ptr != nullptr; j++){
-            if(ptr->col == i){
-                return ptr->value;
-            }
-            ptr = ptr->next;
-        }
-        return 0; //No value exists for column i so return 0
+    static void add(Counter counter, uint64_t amount){
+        local().bump(counter, amount);
     }
     
     
-/* ---Operators--- */
+    /*
+    Post: the calling thread has recorded one more run of operation, taking nanoseconds.
+    */
+    static void addTime(Operation operation, uint64_t nanoseconds){
+        ThreadCounters &counters = local();
+        counters.bump(numCounters + operation, 1);
+        counters.bump(numCounters + numOperations + operation, nanoseconds);
+    }
+    
     
     /*
-    Post: sets the ElementList of the left of the '=' operator to an exact copy of whats on the right, copying and allocating
-          new memory for copied Elements.
+    Times the scope it lives in as one run of an operation.
     */
-    ElementList operator = (const ElementList &rhs){ //Deep Copy equals
-        maxCols = rhs.maxCols;
-        
-        if(list != nullptr){ //Delete lhs's list if it exists
-            deleteList(list);
+    class ScopedTimer {
+    public:
+        ScopedTimer(Operation operation){
+            this->operation = operation;
+            start = chrono::steady_clock::now();
         }
         
-        if(rhs.list != nullptr){
-            list = new Element(rhs.list->col, rhs.list->value, rhs.list->next);
-            Element *leftPtr = list;
-            Element *rightPtr = rhs.list;
-            
-            while(rightPtr->next != nullptr){
-                Element *elementToCopy = rightPtr->next;
-                leftPtr->next = new Element(elementToCopy->col, elementToCopy->value, elementToCopy->next);
-                
-                leftPtr = leftPtr->next;
-                rightPtr = rightPtr->next;
-            }
+        ~ScopedTimer(){
+            addTime(operation, (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
         }
         
-        return *this;
-    }
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer & operator = (const ScopedTimer &) = delete;
+        
+    private:
+        Operation operation;
+        chrono::steady_clock::time_point start;
+    };
+    
     
-
     /*
-    Adds together two ElementLists: ex. [ 1 0 0 2 ] + [ 2 4 0 1 ] is [ 3 4 0 3 ]
-    Post: returns an ElementList with Elements added together which have the same column
+    Post: returns the name used for a counter or an operation when a Snapshot is printed.
     */
-    ElementList operator + (const ElementList &rhs){
-        ElementList newElementList(max(maxCols,rhs.maxCols)); //Create new list with num of elements to match the larger of the two operanded elementlists
-        
-        Element *ptr = list;
-        Element *rhsPtr = rhs.list;
-        while(ptr != nullptr || rhsPtr != nullptr){
-            
-            if(ptr!=nullptr && rhsPtr == nullptr){//If there are elements in lhs that have a bigger col than rhs' maxCols
-                newElementList[ptr->col] = ptr->value;
-                ptr = ptr->next;
-            }
-            else if(rhsPtr!=nullptr && ptr == nullptr){ //If there are elements in rhs that have a bigger col than lhs' maxCols
-                newElementList[rhsPtr->col] = rhsPtr->value;
-                rhsPtr = rhsPtr->next;
-            }
-            
-            
-            else if(ptr != nullptr && rhsPtr != nullptr){ //Elements exists at current pointers
-                if(ptr->col == rhsPtr->col){ //element's cols match so add them together
-                    newElementList[rhsPtr->col] = ptr->value + rhsPtr->value; //Add a new element at the index the two ptr elements share
-                    rhsPtr = rhsPtr->next;
-                    ptr = ptr->next;
-                }
-                
-                else if(ptr->col < rhsPtr->col){ //An element exists in lhs that doesnt in the rhs
-                    newElementList[ptr->col] = ptr->value;
-                    ptr = ptr->next;
-                }
-                else if(ptr->col > rhsPtr->col){ //An element exists in rhs that doesnt in the lhs
-                    newElementList[rhsPtr->col] = rhsPtr->value;
-                    rhsPtr = rhsPtr->next;
-                }
-            }
-        }
-        return newElementList;
+    static const char * name(Counter counter){
+        static const char *names[numCounters] = {"elementAllocations", "elementFrees", "nodesTraversed", "nonZerosInserted", "flops"};
+        return names[counter];
     }
-
+    
+    static const char * name(Operation operation){
+        static const char *names[numOperations] = {"transpose", "multiply", "add", "assign", "copy"};
+        return names[operation];
+    }
+    
+private:
+    static const int numValues = numCounters + 2 * numOperations; //Counters, then calls, then nanoseconds
     
     /*
-    Subtracts two ElementLists: ex. [ 1 0 0 2 ] - [ 2 4 0 1 ] is [ -1 -4 0 1 ]
-    (This function is the same as the addition operator with the execption that it subtracts values and also
-     produces a negative if a value in the rhs exists for a col which doesnt for the lhs in the same col)
-    Post: returns an ElementList with Elements added together which have the same column
+    One thread's counters. Only the owning thread writes them, so a relaxed load and store is enough to
+    add to one, and snapshot() may read them at any time.
     */
-    ElementList operator - (const ElementList &rhs){
-        ElementList newElementList(max(maxCols,rhs.maxCols)); //Create new list with num of elements to match the larger of the two operanded elementlists
+    struct ThreadCounters {
+        atomic<uint64_t> values[numValues];
         
-        Element *ptr = list;
-        Element *rhsPtr = rhs.list;
-        while(ptr != nullptr || rhsPtr != nullptr){
-            
-            if(ptr!=nullptr && rhsPtr == nullptr){//If there are elements in lhs that have a bigger col than rhs' maxCols
-                newElementList[ptr->col] = ptr->value;
-                ptr = ptr->next;
+        ThreadCounters(){
+            for(int i=0; i < numValues; i++){
+                values[i].store(0, memory_order_relaxed);
             }
-            else if(rhsPtr!=nullptr && ptr == nullptr){ //If there are elements in rhs that have a bigger col than lhs' maxCols
-                newElementList[rhsPtr->col] = -rhsPtr->value;
-                rhsPtr = rhsPtr->next;
+        }
+        
+        void bump(int value, uint64_t amount){
+            values[value].store(values[value].load(memory_order_relaxed) + amount, memory_order_relaxed);
+        }
+        
+        void addTo(Snapshot &totals) const {
+            for(int i=0; i < numCounters; i++){
+                totals.counters[i] += values[i].load(memory_order_relaxed);
             }
-            
-            
-            else if(ptr != nullptr && rhsPtr != nullptr){ //Elements exists at current pointers
-                if(ptr->col == rhsPtr->col){ //element's cols match so add them together
-                    newElementList[rhsPtr->col] = ptr->value - rhsPtr->value; //Add a new element at the index the two ptr elements share
-                    rhsPtr = rhsPtr->next;
-                    ptr = ptr->next;
-                }
-                
-                else if(ptr->col < rhsPtr->col){ //An element exists in lhs that doesnt in the rhs
-                    newElementList[ptr->col] = ptr->value;
-                    ptr = ptr->next;
-                }
-                else if(ptr->col > rhsPtr->col){ //An element exists in rhs that doesnt in the lhs
-                    newElementList[rhsPtr->col] = -rhsPtr->value;
-                    rhsPtr = rhsPtr->next;
-                }
+            for(int i=0; i < numOperations; i++){
+                totals.calls[i] += values[numCounters + i].load(memory_order_relaxed);
+                totals.nanoseconds[i] += values[numCounters + numOperations + i].load(memory_order_relaxed);
             }
         }
-        return newElementList;
-    }
-    
+    };
     
     /*
-    Returns a value when ElementList[col] is accessed.
-    Pre:  col must be within the ElementList's range
-    Post: if a value exists at col it is returned. If no value exists, zero is returned
+    The counters of the running threads, and the totals of the threads which have exited.
     */
-    const double operator[] (int col) const {
-        Element * ptr = list;
-        while (ptr != nullptr && ptr->col  < col){
-            ptr = ptr->next;
-        }
-        if (ptr == nullptr || ptr->col  > col)
-            return 0;
-        else
-            return ptr->value;
-    }
-    
+    struct Registry {
+        mutex lock;
+        vector<ThreadCounters *> live;
+        ThreadCounters retired;
+    };
     
     /*
-    Returns a value when ElementList[col] is accessed. Called when an Element at an index is set.
-    Pre:  col must be within the ElementList's range
-    Post: returns the value of the Element at the column in the ElementList. If no Element exists at that column, one is created and it's new value (0) is returned.
+    Registers the calling thread's counters while the thread runs, and folds them into the retired totals
+    when it exits.
     */
-    double & operator[] (int col)  {
-        Element * ptr = list;
-        Element * newNode;
-        Element * trailer = list;
-        if (list == nullptr || col < list->col){
-            newNode = new Element(col,0, list);
-            list = newNode;
-            return newNode->value;
-        } while (ptr != nullptr && ptr->col  < col){
-            trailer = ptr;
-            ptr = ptr->next;
+    struct LocalCounters : ThreadCounters {
+        LocalCounters(){
+            Registry &all = registry();
+            lock_guard<mutex> guard(all.lock);
+            all.live.push_back(this);
         }
         
-        if (ptr != nullptr && ptr->col == col)
-            return ptr->value;
-        else{
-            newNode = new Element(col, 0, ptr);
-            trailer->next = newNode;
-            return newNode->value;
+        ~LocalCounters(){
+            Registry &all = registry();
+            lock_guard<mutex> guard(all.lock);
+            for(int i=0; i < numValues; i++){
+                all.retired.bump(i, values[i].load(memory_order_relaxed));
+            }
+            all.live.erase(find(all.live.begin(), all.live.end(), this));
         }
-    }
+    };
     
-    /* Friends */
-    friend ostream & operator << (ostream &out, ElementList list);
-private:
-    Element *list;
-    int maxCols;
+    /*
+    Never destroyed, as threads such as the WorkerPool's may still exit after static objects are destroyed.
+    */
+    static Registry & registry(){
+        static Registry *all = new Registry();
+        return *all;
+    }
     
-    void deleteList(Element *head){
-        Element *current = head;
-        Element *next;
-        while (current != nullptr && current->next !=nullptr){
-            next = current->next;
-            delete current;
-            current = next;
-        }
-        list = nullptr;
+    static ThreadCounters & local(){
+        static thread_local LocalCounters counters;
+        return counters;
     }
 };
 
 /*
-Prints out an ElementList in the format [ x x x x ]
-Post: returns an ostream with each Element in ElementList list in its correct column with zeros where no element exists.
+Prints a Snapshot as a JSON object, for example to hand to a metrics pipeline:
+{"elementAllocations": 12, ..., "operations": {"transpose": {"calls": 1, "seconds": 2.1e-06}, ...}}
+Post: returns an ostream with every counter and the calls and total time of every operation.
 */
-ostream & operator << (ostream &out, ElementList list){
-    Element *ptr = list.list; //Set a pointer to the ElementList's list pointer
-    out << "[ ";
-    for(int i=0; i<list.maxCols; i++){
-        if(ptr != nullptr && ptr->col == i){
-            out << ptr->value << " ";
-            ptr = ptr->next;
-        }
-        else
-            out << 0 << " ";
+inline ostream & operator << (ostream &out, const Instrumentation::Snapshot &snapshot){
+    out << "{";
+    for(int i=0; i < Instrumentation::numCounters; i++){
+        out << "\"" << Instrumentation::name((Instrumentation::Counter)i) << "\": " << snapshot.counters[i] << ", ";
     }
-    out << "]";
+    out << "\"operations\": {";
+    for(int i=0; i < Instrumentation::numOperations; i++){
+        out << (i == 0 ? "" : ", ") << "\"" << Instrumentation::name((Instrumentation::Operation)i) << "\": {\"calls\": "
+            << snapshot.calls[i] << ", \"seconds\": " << snapshot.nanoseconds[i] * 1e-9 << "}";
+    }
+    out << "}}";
     return out;
 }
 
 
-
-
-
-//MARK: SparseMatrix
-class SparseMatrix {
+//MARK: ElementPool
+/*
+Hands out Element nodes from large slabs of memory instead of allocating each one separately, so
+Elements created one after another sit next to each other. Released nodes are kept on a free list and
+handed out again first. Every slab is returned when the pool is destroyed or releaseAll() is called.
+The methods are virtual so another allocation strategy can be given to an ElementList or SparseMatrix.
+A pool is not thread safe: every list sharing it must be used from one thread at a time.
+*/
+template <class T, class Index>
+class BasicElementPool {
 public:
+    typedef BasicElement<T, Index> Element;
+    
 /* ---Constructors and Destructors--- */
-    SparseMatrix(int n=0, int m=0){
-        numRows = n;
-        numCols = m;
-        rows = new ElementList[n];
-        for(int i=0; i < n; i++){
-            rows[i].set(m);
-        }
+    BasicElementPool(size_t firstSlabSize=256){
+        nextSlabSize = firstSlabSize;
+        freeList = nullptr;
+        slabUsed = 0;
+        slabSize = 0;
+        inUse = 0;
     }
     
-    SparseMatrix(const SparseMatrix &rhs){ //Deep Copy Constructor
-        numRows = rhs.numRows;
-        numCols = rhs.numCols;
-        rows = new ElementList[rhs.numRows];
-        for(int i=0; i < rhs.numRows; i++){
-            rows[i] = rhs.rows[i];
-        }
+    virtual ~BasicElementPool(){
+        BasicElementPool::releaseAll();
     }
     
-    ~SparseMatrix(){ //Destructor
-        delete [] rows; //Will call destructors for each ElementList in the rows array
-    }
+    BasicElementPool(const BasicElementPool &) = delete;
+    BasicElementPool & operator = (const BasicElementPool &) = delete;
     
 /* ---Accessors and Mutators--- */
     
-     /*
-     Transposes values of two SparseMatrixs. Where B.tr() is called B[i][j] = A[j][i].
-     Post: returns a deep copy transpose of self.
-     */
-    SparseMatrix tr(){
-        //Create a new matrix with the numRows and numCols variables swapped
-        SparseMatrix newMatrix(numCols, numRows);
-        
-        for(int row=0; row < newMatrix.numRows; row++){
-            Element *ptr = rows[row].getList(); //point to head of row
-            while(ptr != nullptr && row < numRows){
-                //Swap values from current matrix to the new matrix
-                
-                newMatrix.rows[ptr->col][row] = rows[row][ptr->col]; //Will deep copy the Element
-                ptr = ptr->next;
+    /*
+    Post: returns a new Element holding col, value and next.
+    */
+    virtual Element * allocate(Index col, T value, Element *next){
+        Element *node = freeList;
+        if(node != nullptr)
+            freeList = node->next;
+        else{
+            if(slabUsed == slabSize){ //Current slab is full, so start a new one twice as large (up to maxSlabSize)
+                slabSize = nextSlabSize;
+                nextSlabSize = nextSlabSize * 2 < maxSlabSize ? nextSlabSize * 2 : maxSlabSize;
+                slabs.push_back(static_cast<Element *>(::operator new(slabSize * sizeof(Element))));
+                slabUsed = 0;
             }
+            node = slabs.back() + slabUsed++;
         }
-        
-        return newMatrix;
+        inUse++;
+        return new (node) Element(col, value, next);
     }
     
-/* ---Operators--- */
     
     /*
-    Sets the current SparseMatrix to have equal values to the rhs SparseMatrix
-    Post: returns a SpraseMatrix which has equal values to the rhs
+    Pre:  element was returned by allocate on this pool and is no longer linked into any list.
+    Post: element will be handed out again by a later allocate.
     */
-    SparseMatrix operator = (const SparseMatrix &rhs){
-        
-        numRows = rhs.numRows;
-        numCols = rhs.numCols;
-        
-        delete [] rows; //erase rows from memory
-        rows = new ElementList[rhs.numRows]; //create new list with new size
-        for(int i=0; i < rhs.numRows; i++){
-            rows[i] = rhs.rows[i];
-        }
-        
-        return *this;
+    virtual void release(Element *element){
+        element->next = freeList;
+        freeList = element;
+        inUse--;
     }
     
     
     /*
-    Creates a new matrix square containing multiplied values of the two product matrices.
-    If C = A*B, where A is size n x m and B is m x p then C is n x p
-    And C[i,j] = A[i,0]*B[0,j] + A[i,1]*B[1,j] + ... + A[i,m]*B[m,j]
+    Post: returns how many Elements handed out by allocate have not been released yet.
+    */
+    size_t elementsInUse() const {
+        return inUse;
+    }
     
-    Pre:  rhs numRows must be the exact same as the lhs numCols.
-    Post: returns self * rhs
+    
+    /*
+    Returns the pool a copy of a matrix allocating from this one should use, such as a transpose, a product
+    or a plain copy. Subclasses override it to hand out a new pool of their own kind, so copies keep their
+    allocator. The default ElementPool returns an empty pointer, and the copy creates one only once it needs
+    ElementLists.
     */
-    SparseMatrix operator * (const SparseMatrix &rhs){
-        SparseMatrix newMatrix(numRows, rhs.numCols);
-        int m = numCols; //Value of the matrices' matching col and row
-        
-        for(int row=0; row < newMatrix.numRows; row++){
-            for(int col=0; col < newMatrix.numCols; col++){
-                //Now set the element value for (row,col) in the newMatrix matrix
-                int val = 0;
-                
-                //Calculate the value for pos (row,col) in newMatrix
-                for(int counter=0; counter<m; counter++){ //run through the rows and cols to find the value of what newMatrix at (row,col) should be
-                        double lhsVal = rows[row].getIth(counter);
-                        double rhsVal = rhs.rows[counter].getIth(col);//gets value at current col
-                        val += (lhsVal * rhsVal);
-                }
-                
-     
-                if(val != 0)//if the value is zero, dont record it since its the default access value
-                    newMatrix.rows[row][col] = val; //Set the calculated value
-            }
-        }
-
-        return newMatrix;
+    virtual shared_ptr<BasicElementPool> newPool() const {
+        return shared_ptr<BasicElementPool>();
     }
     
     
     /*
-    Returns a value when SparseMatrix[row] is accessed.
-    Pre:  row must be within the SparseMatrix's range
-    Post: returns the elementlist in the Sparsematrix at the row row
+    Frees every slab at once, which is much faster than releasing Elements one at a time.
+    Pre:  no Element handed out by the pool is still in use.
     */
-    const ElementList operator [] (int row ) const{
-        return rows[row];
+    virtual void releaseAll(){
+        for(size_t i=0; i < slabs.size(); i++){
+            ::operator delete(slabs[i]);
+        }
+        slabs.clear();
+        freeList = nullptr;
+        slabUsed = 0;
+        slabSize = 0;
+        inUse = 0;
     }
+    
+private:
+    static const size_t maxSlabSize = 1 << 16;
+    
+    vector<Element *> slabs;
+    Element *freeList;
+    size_t slabUsed;     //Elements handed out from the newest slab
+    size_t slabSize;     //Capacity of the newest slab
+    size_t nextSlabSize;
+    size_t inUse;        //Elements handed out and not yet released
+};
 
+typedef BasicElementPool<double, int> ElementPool;
+
+
+
+
+
+//MARK: RowIndex
+/*
+A lookup index over the Elements of a long ElementList, kept next to the list so finding a column no
+longer walks the list from its head. The Elements stay linked in the list; the index only holds pointers
+to them. Every row with an index keeps its (column, Element) pairs in a sorted array which is binary
+searched. Rows of at least hashThreshold Elements also fill an open addressing hash table keyed by column,
+so a lookup costs one or two probes however long the row grows.
+*/
+template <class T, class Index>
+class BasicRowIndex {
+public:
+    typedef BasicElement<T, Index> Element;
+    
+/* ---Accessors and Mutators--- */
     
     /*
-    Returns a value when SparseMatrix[row] is accessed. Called when an ElementList at an index is set.
-    Pre:  row must be within the SparseMatrix's range
-    Post: returns the elementlist in the Sparsematrix at the row row
+    Post: the index holds every Element of list, which must be sorted by column.
     */
-    ElementList & operator [] (int row){
-        return rows[row];
+    void build(Element *list){
+        entries.clear();
+        for(Element *ptr = list; ptr != nullptr; ptr = ptr->next){
+            entries.push_back(Entry(ptr->col, ptr));
+        }
+        rehash();
     }
     
     
-/*---Unit Tests---*/
     /*
-    Unit test for multiplying two sparsematrices. Checks if after multiplying the resulting
+    Post: the index is empty and its memory released.
+    */
+    void clear(){
+        vector<Entry>().swap(entries);
+        vector<Element *>().swap(slots);
+    }
+    
+    
+    bool empty() const {
+        return entries.empty();
+    }
+    
+    
+    size_t size() const {
+        return entries.size();
+    }
+    
+    
+    /*
+    Post: returns the Element at col, or nullptr if the row has none.
+    */
+    Element * find(Index col) const {
+        if(!slots.empty()){
+            for(size_t i = slot(col); slots[i] != nullptr; i = (i + 1) & (slots.size() - 1)){
+                if(slots[i]->col == col)
+                    return slots[i];
+            }
+            return nullptr;
+        }
+        typename vector<Entry>::const_iterator it = lowerBound(col);
+        return (it == entries.end() || it->first != col) ? nullptr : it->second;
+    }
+    
+    
+    /*
+    Post: returns the last Element with a column below col, which a new Element at col is linked after,
+          or nullptr if col comes first.
+    */
+    Element * before(Index col) const {
+        typename vector<Entry>::const_iterator it = lowerBound(col);
+        return it == entries.begin() ? nullptr : (it - 1)->second;
+    }
+    
+    
+    /*
+    Adds an Element which has just been linked into the list.
+    Pre:  no Element at the same column is in the index.
+    */
+    void insert(Element *element){
+        entries.insert(lowerBound(element->col), Entry(element->col, element));
+        if(entries.size() * 2 > slots.size()) //Keeps the table at most half full
+            rehash();
+        else
+            place(element);
+    }
+    
+private:
+    typedef pair<Index, Element *> Entry;
+    vector<Entry> entries; //Sorted by column
+    vector<Element *> slots; //Empty below hashThreshold Elements, otherwise a power of two long
+    
+    static const size_t hashThreshold = 256;
+    
+    typename vector<Entry>::const_iterator lowerBound(Index col) const {
+        return lower_bound(entries.begin(), entries.end(), col, [](const Entry &entry, Index c){ return entry.first < c; });
+    }
+    
+    size_t slot(Index col) const {
+        return (size_t)(((uint64_t)col * 0x9E3779B97F4A7C15ULL) >> 32) & (slots.size() - 1);
+    }
+    
+    void place(Element *element){
+        size_t i = slot(element->col);
+        while(slots[i] != nullptr){
+            i = (i + 1) & (slots.size() - 1);
+        }
+        slots[i] = element;
+    }
+    
+    void rehash(){
+        if(entries.size() < hashThreshold){
+            vector<Element *>().swap(slots);
+            return;
+        }
+        size_t capacity = 1;
+        while(capacity < entries.size() * 4){
+            capacity *= 2;
+        }
+        slots.assign(capacity, nullptr);
+        for(size_t i=0; i < entries.size(); i++){
+            place(entries[i].second);
+        }
+    }
+};
+
+
+
+
+
+//MARK: ElementList
+template <class T, class Index>
+class BasicElementList{
+public:
+    typedef BasicElement<T, Index> Element;
+    typedef BasicElementPool<T, Index> ElementPool;
+    typedef BasicRowIndex<T, Index> RowIndex;
+    
+/* ---Constructors and Destructors--- */
+    /*
+    Elements are allocated from pool when one is given, and with new otherwise.
+    */
+    BasicElementList(const Index max=0, const shared_ptr<ElementPool> &pool=shared_ptr<ElementPool>()){
+        maxCols = max;
+        list = nullptr;
+        length = 0;
+        this->pool = pool;
+    }
+    
+    BasicElementList(const BasicElementList &rhs){ //Deep Copy Constructor, allocating from the same pool as rhs
+        maxCols = rhs.maxCols;
+        pool = rhs.pool;
+        list = rhs.list;
+        length = 0;
+        if(list != nullptr){
+            list = newElement(rhs.list->col, rhs.list->value, rhs.list->next);
+            Element *leftPtr = list;
+            Element *rightPtr = rhs.list;
+            
+            while(rightPtr->next != nullptr){
+                Element *elementToCopy = rightPtr->next;
+                leftPtr->next = newElement(elementToCopy->col, elementToCopy->value, elementToCopy->next);
+                
+                leftPtr = leftPtr->next;
+                rightPtr = rightPtr->next;
+            }
+        }
+    }
+    
+    BasicElementList(BasicElementList &&rhs){ //Move Constructor, takes over rhs's Elements and leaves it empty
+        maxCols = rhs.maxCols;
+        list = rhs.list;
+        length = rhs.length;
+        pool = move(rhs.pool);
+        index = move(rhs.index);
+        rhs.list = nullptr;
+        rhs.length = 0;
+    }
+    
+    ~BasicElementList(){ //Destructor
+        deleteList(list);
+    }
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Sets the how many columns an ElementList should have, and optionally the pool its Elements come from.
+    Post: the ElementList will contain the number of max afterwards. The list variable is also set to nullptr
+    */
+    void set(Index max, const shared_ptr<ElementPool> &pool=shared_ptr<ElementPool>()){
+        list = nullptr;
+        length = 0;
+        maxCols = max;
+        this->pool = pool;
+        index.reset();
+    }
+    
+    
+    /*
+    Post: returns the first Element in the ElementList. As Elements may be linked in or out through the
+          returned link, the non-const version drops the row's index.
+    */
+    Element *& getList(){
+        index.reset();
+        return list;
+    }
+    
+    Element * getList() const {
+        return list;
+    }
+    
+    
+    /*
+    Post: returns the row's index, or nullptr while the row has none.
+    */
+    const RowIndex * getIndex() const {
+        return index.get();
+    }
+    
+    
+    /*
+    Builds the row's index now instead of on the next long walk of operator[], so reads through a const
+    matrix, which never build one, are fast too. Rows shorter than indexThreshold are left without one.
+    */
+    void buildIndex(){
+        index.reset(new RowIndex());
+        index->build(list);
+        if(index->size() < indexThreshold)
+            index.reset();
+    }
+    
+    
+    /*
+    Post: Returns the value of the list at column i. If no Element exists at column, zero is returned.
+    */
+    T getIth(Index i) const {
+        if(index){
+            Element *found = index->find(i);
+            return found == nullptr ? 0 : found->value;
+        }
+        Element *ptr = list;
+        Index j=0;
+        for(; j<maxCols && ptr != nullptr; j++){
+            if(ptr->col == i){
+                SPARSEMATRIX_COUNT(NodesTraversed, j);
+                return ptr->value;
+            }
+            ptr = ptr->next;
+        }
+        SPARSEMATRIX_COUNT(NodesTraversed, j);
+        return 0; //No value exists for column i so return 0
+    }
+    
+    
+    /*
+    Adds an Element to the end of the ElementList without walking it.
+    Pre:  tail is the last Element of the list (nullptr if the list is empty) and col is larger than
+          every column already in the list.
+    Post: returns the new last Element of the list.
+    */
+    Element * append(Element *tail, Index col, T value){
+        index.reset();
+        Element *newNode = newElement(col, value, nullptr);
+        if(tail == nullptr)
+            list = newNode;
+        else
+            tail->next = newNode;
+        return newNode;
+    }
+    
+    
+    /*
+    Adds alpha times rhs into the list in place: ex. [ 1 0 2 ].axpy(2, [ 1 3 0 ]) is [ 3 6 2 ]
+    Both lists are walked once side by side and new Elements are linked in where they belong, so the
+    cost is linear in the two lengths. rhs may be the list itself.
+    Post: returns the list, holding self + alpha*rhs
+    */
+    BasicElementList & axpy(T alpha, const BasicElementList &rhs){
+        maxCols = max(maxCols, rhs.maxCols);
+        index.reset();
+        Element **link = &list;
+        for(const Element *ptr = rhs.list; ptr != nullptr; ptr = ptr->next){
+            link = mergeAt(link, ptr->col, alpha * ptr->value);
+        }
+        return *this;
+    }
+    
+    
+/* ---Operators--- */
+    
+    /*
+    Post: sets the ElementList of the left of the '=' operator to an exact copy of whats on the right, copying and allocating
+          new memory for copied Elements from the left's pool.
+    */
+    BasicElementList & operator = (const BasicElementList &rhs){ //Deep Copy equals
+        if(this == &rhs)
+            return *this;
+        maxCols = rhs.maxCols;
+        
+        if(list != nullptr){ //Delete lhs's list if it exists
+            deleteList(list);
+        }
+        
+        if(rhs.list != nullptr){
+            list = newElement(rhs.list->col, rhs.list->value, rhs.list->next);
+            Element *leftPtr = list;
+            Element *rightPtr = rhs.list;
+            
+            while(rightPtr->next != nullptr){
+                Element *elementToCopy = rightPtr->next;
+                leftPtr->next = newElement(elementToCopy->col, elementToCopy->value, elementToCopy->next);
+                
+                leftPtr = leftPtr->next;
+                rightPtr = rightPtr->next;
+            }
+        }
+        
+        return *this;
+    }
+    
+    
+    /*
+    Post: the ElementList takes over rhs's Elements (and the pool they came from) without copying, and rhs is left empty.
+    */
+    BasicElementList & operator = (BasicElementList &&rhs){ //Move equals
+        if(this == &rhs)
+            return *this;
+        deleteList(list);
+        maxCols = rhs.maxCols;
+        list = rhs.list;
+        length = rhs.length;
+        pool = move(rhs.pool);
+        index = move(rhs.index);
+        rhs.list = nullptr;
+        rhs.length = 0;
+        return *this;
+    }
+    
+
+    /*
+    Adds together two ElementLists: ex. [ 1 0 0 2 ] + [ 2 4 0 1 ] is [ 3 4 0 3 ]
+    Post: returns an ElementList with Elements added together which have the same column
+    */
+    BasicElementList operator + (const BasicElementList &rhs) const {
+        return combine(rhs, 1);
+    }
+
+    
+    /*
+    Subtracts two ElementLists: ex. [ 1 0 0 2 ] - [ 2 4 0 1 ] is [ -1 -4 0 1 ]
+    (This function is the same as the addition operator with the execption that it subtracts values and also
+     produces a negative if a value in the rhs exists for a col which doesnt for the lhs in the same col)
+    Post: returns an ElementList with Elements added together which have the same column
+    */
+    BasicElementList operator - (const BasicElementList &rhs) const {
+        return combine(rhs, -1);
+    }
+    
+    
+    /*
+    Post: adds rhs into the list in place (see axpy) and returns the list
+    */
+    BasicElementList & operator += (const BasicElementList &rhs){
+        return axpy(1, rhs);
+    }
+    
+    
+    /*
+    Post: subtracts rhs from the list in place (see axpy) and returns the list
+    */
+    BasicElementList & operator -= (const BasicElementList &rhs){
+        return axpy(-1, rhs);
+    }
+    
+    
+    /*
+    Returns a value when ElementList[col] is accessed. A row with an index looks col up in it.
+    Pre:  col must be within the ElementList's range
+    Post: if a value exists at col it is returned. If no value exists, zero is returned
+    */
+    T operator[] (Index col) const {
+        if(index){
+            Element *found = index->find(col);
+            return found == nullptr ? 0 : found->value;
+        }
+        Element * ptr = list;
+        size_t walked = 0;
+        while (ptr != nullptr && ptr->col  < col){
+            ptr = ptr->next;
+            walked++;
+        }
+        SPARSEMATRIX_COUNT(NodesTraversed, walked);
+        if (ptr == nullptr || ptr->col  > col)
+            return 0;
+        else
+            return ptr->value;
+    }
+    
+    
+    /*
+    Returns a value when ElementList[col] is accessed. Called when an Element at an index is set.
+    A row with an index finds col, or the Element to link a new one after, in the index and keeps the index
+    up to date. A row without one is walked, and gets an index once a walk passes indexThreshold Elements.
+    Pre:  col must be within the ElementList's range
+    Post: returns the value of the Element at the column in the ElementList. If no Element exists at that column, one is created and it's new value (0) is returned.
+    */
+    T & operator[] (Index col)  {
+        Element * ptr = list;
+        Element * newNode;
+        Element * trailer = list;
+        if(index){
+            Element *found = index->find(col);
+            if(found != nullptr)
+                return found->value;
+            trailer = index->before(col);
+            Element *&link = trailer == nullptr ? list : trailer->next;
+            newNode = newElement(col, 0, link);
+            link = newNode;
+            index->insert(newNode);
+            SPARSEMATRIX_COUNT(NonZerosInserted, 1);
+            return newNode->value;
+        }
+        if (list == nullptr || col < list->col){
+            newNode = newElement(col,0, list);
+            list = newNode;
+            SPARSEMATRIX_COUNT(NonZerosInserted, 1);
+            return newNode->value;
+        }
+        size_t walked = 0;
+        while (ptr != nullptr && ptr->col  < col){
+            trailer = ptr;
+            ptr = ptr->next;
+            walked++;
+        }
+        
+        SPARSEMATRIX_COUNT(NodesTraversed, walked);
+        if (ptr != nullptr && ptr->col == col)
+            newNode = ptr;
+        else{
+            newNode = newElement(col, 0, ptr);
+            trailer->next = newNode;
+            SPARSEMATRIX_COUNT(NonZerosInserted, 1);
+        }
+        if(walked >= indexThreshold)
+            buildIndex();
+        return newNode->value;
+    }
+    
+    /* Friends */
+    template <class U, class I> friend ostream & operator << (ostream &out, const BasicElementList<U, I> &list);
+    template <class U, class I> friend class BasicSparseMatrix;
+    static const size_t indexThreshold = 64; //Rows are indexed once a lookup walks this many Elements
+    
+private:
+    Element *list;
+    Index maxCols;
+    size_t length; //Elements in list, so a matrix can tell whether its rows hold everything their pool handed out
+    shared_ptr<ElementPool> pool; //Empty when Elements are allocated with new
+    unique_ptr<RowIndex> index; //nullptr for short rows
+    
+    /*
+    Builds self + alpha*rhs as a new list in a single pass over both lists, appending each result at the tail.
+    */
+    BasicElementList combine(const BasicElementList &rhs, T alpha) const {
+        BasicElementList newElementList(max(maxCols,rhs.maxCols), pool); //Create new list with num of elements to match the larger of the two operanded elementlists
+        Element *tail = nullptr;
+        const Element *ptr = list;
+        const Element *rhsPtr = rhs.list;
+        while(ptr != nullptr || rhsPtr != nullptr){
+            if(rhsPtr == nullptr || (ptr != nullptr && ptr->col < rhsPtr->col)){ //An element exists in lhs that doesnt in the rhs
+                tail = newElementList.append(tail, ptr->col, ptr->value);
+                ptr = ptr->next;
+            }
+            else if(ptr == nullptr || rhsPtr->col < ptr->col){ //An element exists in rhs that doesnt in the lhs
+                tail = newElementList.append(tail, rhsPtr->col, alpha * rhsPtr->value);
+                rhsPtr = rhsPtr->next;
+            }
+            else{ //element's cols match so add them together
+                tail = newElementList.append(tail, ptr->col, ptr->value + alpha * rhsPtr->value);
+                ptr = ptr->next;
+                rhsPtr = rhsPtr->next;
+            }
+        }
+        return newElementList;
+    }
+    
+    /*
+    Adds value at col, starting the search for col at link, the link where the previous column was merged.
+    Pre:  every Element before link has a column below col.
+    Post: returns the link just past the Element holding col.
+    */
+    Element ** mergeAt(Element **link, Index col, T value){
+        while(*link != nullptr && (*link)->col < col){
+            link = &(*link)->next;
+        }
+        if(*link != nullptr && (*link)->col == col)
+            (*link)->value += value;
+        else{
+            *link = newElement(col, value, *link);
+            SPARSEMATRIX_COUNT(NonZerosInserted, 1);
+        }
+        return &(*link)->next;
+    }
+    
+    Element * newElement(Index col, T value, Element *next){
+        SPARSEMATRIX_COUNT(ElementAllocations, 1);
+        length++;
+        if(pool)
+            return pool->allocate(col, value, next);
+        return new Element(col, value, next);
+    }
+    
+    void deleteList(Element *head){
+        Element *current = head;
+        Element *next;
+        size_t released = 0;
+        while (current != nullptr){
+            next = current->next;
+            if(pool)
+                pool->release(current);
+            else
+                delete current;
+            current = next;
+            released++;
+        }
+        SPARSEMATRIX_COUNT(ElementFrees, released);
+        list = nullptr;
+        length = 0;
+        index.reset();
+    }
+};
+
+/*
+Prints out an ElementList in the format [ x x x x ]
+Post: returns an ostream with each Element in ElementList list in its correct column with zeros where no element exists.
+*/
+template <class T, class Index>
+ostream & operator << (ostream &out, const BasicElementList<T, Index> &list){
+    BasicElement<T, Index> *ptr = list.list; //Set a pointer to the ElementList's list pointer
+    out << "[ ";
+    for(Index i=0; i<list.maxCols; i++){
+        if(ptr != nullptr && ptr->col == i){
+            out << +ptr->value << " ";
+            ptr = ptr->next;
+        }
+        else
+            out << 0 << " ";
+    }
+    out << "]";
+    return out;
+}
+
+typedef BasicElementList<double, int> ElementList;
+
+
+
+
+
+//MARK: MappedFile
+/*
+A read-only memory mapping of a whole file. The pages are shared with the operating system's file
+cache, so nothing is read or copied until it is touched. isOpen() is false when the file could not be
+opened or mapped.
+*/
+class MappedFile {
+public:
+/* ---Constructors and Destructors--- */
+    MappedFile(const string &path){
+        bytes = nullptr;
+        length = 0;
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return;
+        
+        struct stat info;
+        if(fstat(fd, &info) == 0 && info.st_size > 0){
+            void *mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if(mapping != MAP_FAILED){
+                bytes = static_cast<const char *>(mapping);
+                length = (size_t)info.st_size;
+            }
+        }
+        close(fd); //The mapping stays valid after the descriptor is closed
+    }
+    
+    ~MappedFile(){
+        if(bytes != nullptr)
+            munmap(const_cast<char *>(bytes), length);
+    }
+    
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator = (const MappedFile &) = delete;
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Post: returns true if the file is mapped.
+    */
+    bool isOpen() const {
+        return bytes != nullptr;
+    }
+    
+    /*
+    Post: returns the first byte of the file, or nullptr if it is not mapped.
+    */
+    const char * data() const {
+        return bytes;
+    }
+    
+    /*
+    Post: returns the size of the file in bytes.
+    */
+    size_t size() const {
+        return length;
+    }
+    
+    /*
+    Tells the operating system the file will be read front to back, so it reads ahead aggressively.
+    */
+    void adviseSequential() const {
+        if(bytes != nullptr)
+            madvise(const_cast<char *>(bytes), length, MADV_SEQUENTIAL);
+    }
+    
+private:
+    const char *bytes;
+    size_t length;
+};
+
+
+
+
+
+//MARK: CompressedArray
+/*
+One of the arrays of a CompressedStorage. It either owns its items or is a read-only view of items kept
+somewhere else, such as a memory mapped file. Anything which resizes a view first copies it into memory
+of its own; a view must not be written through operator[].
+*/
+template <class T>
+class CompressedArray {
+public:
+/* ---Constructors and Destructors--- */
+    CompressedArray(){
+        items = nullptr;
+        length = 0;
+        external = false;
+    }
+    
+    CompressedArray(const CompressedArray &rhs){ //Copies owned items, shares viewed ones
+        items = nullptr;
+        length = 0;
+        external = false;
+        *this = rhs;
+    }
+    
+    CompressedArray(CompressedArray &&rhs){
+        items = nullptr;
+        length = 0;
+        external = false;
+        *this = move(rhs);
+    }
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Makes the array a view of count items at first, which must outlive it.
+    */
+    void view(const T *first, size_t count){
+        vector<T>().swap(owned);
+        items = const_cast<T *>(first);
+        length = count;
+        external = true;
+    }
+    
+    /*
+    Post: returns true if the array is a view of items it does not own.
+    */
+    bool isView() const {
+        return external;
+    }
+    
+    T * data(){
+        return items;
+    }
+    
+    const T * data() const {
+        return items;
+    }
+    
+    size_t size() const {
+        return length;
+    }
+    
+    void resize(size_t count){
+        detach();
+        owned.resize(count);
+        sync();
+    }
+    
+    void assign(size_t count, const T &value){
+        owned.assign(count, value);
+        external = false;
+        sync();
+    }
+    
+    void assign(vector<T> &&values){
+        owned = move(values);
+        external = false;
+        sync();
+    }
+    
+    void push_back(const T &value){
+        detach();
+        owned.push_back(value);
+        sync();
+    }
+    
+    void clear(){
+        vector<T>().swap(owned);
+        external = false;
+        sync();
+    }
+    
+/* ---Operators--- */
+    
+    CompressedArray & operator = (const CompressedArray &rhs){
+        if(this == &rhs)
+            return *this;
+        if(rhs.external)
+            view(rhs.items, rhs.length);
+        else{
+            owned = rhs.owned;
+            external = false;
+            sync();
+        }
+        return *this;
+    }
+    
+    CompressedArray & operator = (CompressedArray &&rhs){
+        if(this == &rhs)
+            return *this;
+        if(rhs.external)
+            view(rhs.items, rhs.length);
+        else{
+            owned = move(rhs.owned);
+            external = false;
+            sync();
+        }
+        rhs.clear();
+        return *this;
+    }
+    
+    T & operator [] (size_t i){
+        return items[i];
+    }
+    
+    const T & operator [] (size_t i) const {
+        return items[i];
+    }
+    
+private:
+    vector<T> owned;
+    T *items;      //owned.data(), or the viewed items
+    size_t length;
+    bool external;
+    
+    void detach(){
+        if(external){
+            owned.assign(items, items + length);
+            external = false;
+        }
+    }
+    
+    void sync(){
+        items = owned.data();
+        length = owned.size();
+    }
+};
+
+
+
+
+
+//MARK: CompressedStorage
+/*
+Contiguous storage for a frozen SparseMatrix. In row form (CSR) the Elements of row r are found at
+positions offsets[r] .. offsets[r+1]-1 of indices (their columns) and values. In column form (CSC) the
+same arrays describe columns instead, with indices holding row numbers. The arrays may be views into
+a memory mapped file, which mapping then keeps open.
+*/
+template <class T, class Index>
+struct BasicCompressedStorage {
+    CompressedArray<size_t> offsets;
+    CompressedArray<Index> indices;
+    CompressedArray<T> values;
+    shared_ptr<MappedFile> mapping;
+    
+    /*
+    Post: returns the number of Elements stored.
+    */
+    size_t size() const {
+        return values.size();
+    }
+    
+    /*
+    Post: releases all memory held by the storage.
+    */
+    void clear(){
+        offsets.clear();
+        indices.clear();
+        values.clear();
+        mapping.reset();
+    }
+};
+
+typedef BasicCompressedStorage<double, int> CompressedStorage;
+
+
+
+
+
+//MARK: RowView
+/*
+A read-only view of one row of a SparseMatrix, returned by SparseMatrix[row] on a const matrix so that
+reading matrix[row][col] or printing a row copies nothing. The view points into the matrix, so it is
+only valid until the matrix is next changed, frozen or thawed.
+*/
+template <class T, class Index>
+class BasicRowView {
+public:
+    typedef BasicElement<T, Index> Element;
+    typedef BasicRowIndex<T, Index> RowIndex;
+    
+/* ---Constructors and Destructors--- */
+    BasicRowView(const Element *list, Index maxCols, const RowIndex *index=nullptr){ //View of an ElementList
+        this->list = list;
+        this->index = index;
+        this->cols = nullptr;
+        this->values = nullptr;
+        this->length = 0;
+        this->maxCols = maxCols;
+    }
+    
+    BasicRowView(const Index *cols, const T *values, size_t length, Index maxCols){ //View of a frozen row
+        this->list = nullptr;
+        this->index = nullptr;
+        this->cols = cols;
+        this->values = values;
+        this->length = length;
+        this->maxCols = maxCols;
+    }
+    
+/* ---Operators--- */
+    
+    /*
+    Pre:  col must be within the row's range
+    Post: returns the value stored at col, or zero if no Element exists there. A frozen row is binary searched,
+          and a row with an index is looked up in it.
+    */
+    T operator[] (Index col) const {
+        if(index != nullptr){
+            const Element *found = index->find(col);
+            return found == nullptr ? 0 : found->value;
+        }
+        if(cols == nullptr){
+            const Element *ptr = list;
+            size_t walked = 0;
+            while(ptr != nullptr && ptr->col < col){
+                ptr = ptr->next;
+                walked++;
+            }
+            SPARSEMATRIX_COUNT(NodesTraversed, walked);
+            return (ptr == nullptr || ptr->col > col) ? 0 : ptr->value;
+        }
+        const Index *ptr = lower_bound(cols, cols + length, col);
+        return (ptr == cols + length || *ptr != col) ? 0 : values[ptr - cols];
+    }
+    
+    /* Friends */
+    template <class U, class I> friend ostream & operator << (ostream &out, const BasicRowView<U, I> &row);
+private:
+    const Element *list;
+    const RowIndex *index;
+    const Index *cols;
+    const T *values;
+    size_t length;
+    Index maxCols;
+};
+
+/*
+Prints out a row in the same [ x x x x ] format as an ElementList
+Post: returns an ostream with each Element of the row in its correct column with zeros where no element exists.
+*/
+template <class T, class Index>
+ostream & operator << (ostream &out, const BasicRowView<T, Index> &row){
+    const BasicElement<T, Index> *ptr = row.list;
+    size_t pos = 0;
+    out << "[ ";
+    for(Index i=0; i < row.maxCols; i++){
+        if(ptr != nullptr && ptr->col == i){
+            out << +ptr->value << " ";
+            ptr = ptr->next;
+        }
+        else if(pos < row.length && row.cols[pos] == i){
+            out << +row.values[pos] << " ";
+            pos++;
+        }
+        else
+            out << 0 << " ";
+    }
+    out << "]";
+    return out;
+}
+
+typedef BasicRowView<double, int> RowView;
+
+
+
+
+
+//MARK: RowReference
+/*
+One row of a non-const SparseMatrix, returned by SparseMatrix[row]. Reading matrix[row][col] goes through
+a RowView, so it neither thaws a frozen matrix nor creates an Element; only writing a value, assigning the
+row or taking the row as an ElementList thaws the matrix. Like a RowView it is only valid while the matrix
+is alive.
+*/
+template <class T, class Index>
+class BasicRowReference {
+public:
+    typedef BasicSparseMatrix<T, Index> Matrix;
+    typedef BasicElementList<T, Index> ElementList;
+    typedef BasicRowView<T, Index> RowView;
+    
+    /*
+    The value at one position, read through the matrix's RowView and written through its ElementList.
+    */
+    class ValueReference {
+    public:
+        ValueReference(Matrix *matrix, Index row, Index col){
+            this->matrix = matrix;
+            this->row = row;
+            this->col = col;
+        }
+        
+        operator T () const {
+            return matrix->rowView(row)[col];
+        }
+        
+        ValueReference & operator = (T value){
+            writable() = value;
+            return *this;
+        }
+        
+        ValueReference & operator = (const ValueReference &rhs){ //Copies the value, not the reference
+            return *this = (T)rhs;
+        }
+        
+        ValueReference & operator += (T value){
+            writable() += value;
+            return *this;
+        }
+        
+        ValueReference & operator -= (T value){
+            writable() -= value;
+            return *this;
+        }
+        
+        ValueReference & operator *= (T value){
+            writable() *= value;
+            return *this;
+        }
+        
+        ValueReference & operator /= (T value){
+            writable() /= value;
+            return *this;
+        }
+    private:
+        Matrix *matrix;
+        Index row;
+        Index col;
+        
+        /*
+        Post: returns the Element's value, thawing the matrix and creating the Element if needed.
+        */
+        T & writable() const {
+            return matrix->writableRow(row)[col];
+        }
+    };
+    
+/* ---Constructors and Destructors--- */
+    BasicRowReference(Matrix *matrix, Index row){
+        this->matrix = matrix;
+        this->row = row;
+    }
+    
+/* ---Accessors and Mutators--- */
+    /*
+    Post: returns the value stored at col, or zero if no Element exists there, without changing the matrix.
+    */
+    T getIth(Index col) const {
+        return matrix->rowView(row)[col];
+    }
+    
+    /*
+    Post: returns the row as its ElementList, thawing a frozen matrix first.
+    */
+    ElementList & list() const {
+        return matrix->writableRow(row);
+    }
+    
+/* ---Operators--- */
+    ValueReference operator [] (Index col) const {
+        return ValueReference(matrix, row, col);
+    }
+    
+    operator RowView () const {
+        return matrix->rowView(row);
+    }
+    
+    operator ElementList & () const { //For code which needs the row's list, such as copying it
+        return list();
+    }
+    
+    BasicRowReference & operator = (const ElementList &rhs){
+        list() = rhs;
+        return *this;
+    }
+    
+    ElementList operator + (const ElementList &rhs) const {
+        return list() + rhs;
+    }
+    
+    ElementList operator - (const ElementList &rhs) const {
+        return list() - rhs;
+    }
+private:
+    Matrix *matrix;
+    Index row;
+};
+
+/*
+Prints the row as its RowView does, without thawing the matrix.
+*/
+template <class T, class Index>
+ostream & operator << (ostream &out, const BasicRowReference<T, Index> &row){
+    return out << BasicRowView<T, Index>(row);
+}
+
+typedef BasicRowReference<double, int> RowReference;
+
+
+
+
+
+//MARK: WorkerPool
+/*
+A fixed set of worker threads used by the parallel kernels. run(numTasks, task) hands out the task
+numbers 0 .. numTasks-1 to the workers and the calling thread, and returns once every task is done.
+A task which itself calls run() has its inner tasks executed on its own thread. runStealing()
+spreads a range of items of uneven cost over the threads by letting idle threads steal from busy ones.
+*/
+class WorkerPool {
+public:
+/* ---Constructors and Destructors--- */
+    WorkerPool(unsigned numThreads){
+        job = nullptr;
+        numTasks = 0;
+        nextTask = 0;
+        active = 0;
+        generation = 0;
+        stopping = false;
+        for(unsigned i=1; i < numThreads; i++){ //The calling thread is the first worker
+            workers.push_back(thread(&WorkerPool::workerLoop, this));
+        }
+    }
+    
+    ~WorkerPool(){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(size_t i=0; i < workers.size(); i++){
+            workers[i].join();
+        }
+    }
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Post: returns the pool shared by every SparseMatrix, sized to the number of hardware threads.
+    */
+    static WorkerPool & shared(){
+        static WorkerPool pool(max(1u, thread::hardware_concurrency()));
+        return pool;
+    }
+    
+    
+    /*
+    Post: returns the number of threads which work on a run() call, including the caller.
+    */
+    unsigned size() const {
+        return (unsigned)workers.size() + 1;
+    }
+    
+    
+    /*
+    Runs task(i) for every i in [0, numTasks). Tasks are claimed one at a time, so callers should
+    split their work into a few more tasks than there are threads.
+    Post: every task has finished.
+    */
+    void run(int numTasks, const function<void(int)> &task){
+        if(workers.empty() || numTasks <= 1 || insideTask()){
+            for(int i=0; i < numTasks; i++){
+                task(i);
+            }
+            return;
+        }
+        
+        lock_guard<mutex> runGuard(runLock); //One run() at a time owns the workers
+        {
+            lock_guard<mutex> guard(lock);
+            job = &task;
+            this->numTasks = numTasks;
+            nextTask = 0;
+            active = (int)workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        
+        work(task, numTasks);
+        
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [this]{ return active == 0; });
+        job = nullptr;
+    }
+    
+    
+    /*
+    Runs task(begin, end, slot) over the items [0, bounds.back()) with work stealing. Slot s starts
+    with the items [bounds[s], bounds[s+1]) and takes grain of them at a time from the front. A slot
+    whose items run out steals the back half of the largest range left, so a few expensive items
+    cannot leave the other threads idle. Each slot is run by one thread at a time, which lets callers
+    keep per-slot scratch space without locking.
+    Pre:  bounds holds numSlots+1 nondecreasing boundaries and grain is at least 1.
+    Post: every item has been passed to task exactly once.
+    */
+    void runStealing(const vector<int> &bounds, int grain, const function<void(int, int, int)> &task){
+        int numSlots = (int)bounds.size() - 1;
+        unique_ptr<StealRange[]> ranges(new StealRange[numSlots]);
+        for(int s=0; s < numSlots; s++){
+            ranges[s].range = packRange(bounds[s], bounds[s+1]);
+        }
+        
+        run(numSlots, [&](int slot){
+            atomic<uint64_t> &own = ranges[slot].range;
+            while(true){
+                //Take the next grain from the front of this slot's own range
+                uint64_t current = own.load();
+                int begin = rangeBegin(current), end = rangeEnd(current);
+                if(begin < end){
+                    int next = end - begin > grain ? begin + grain : end;
+                    if(own.compare_exchange_weak(current, packRange(next, end)))
+                        task(begin, next, slot);
+                    continue;
+                }
+                
+                //Out of work: split the largest range left and keep its back half
+                int victim = -1, largest = 0;
+                for(int s=0; s < numSlots; s++){
+                    uint64_t other = ranges[s].range.load();
+                    if(rangeEnd(other) - rangeBegin(other) > largest){
+                        largest = rangeEnd(other) - rangeBegin(other);
+                        victim = s;
+                    }
+                }
+                if(victim < 0)
+                    return;
+                uint64_t other = ranges[victim].range.load();
+                begin = rangeBegin(other);
+                end = rangeEnd(other);
+                if(begin >= end)
+                    continue;
+                int middle = begin + (end - begin) / 2;
+                if(ranges[victim].range.compare_exchange_strong(other, packRange(begin, middle)))
+                    own.store(packRange(middle, end)); //No thief touches an empty range, so this cannot race
+            }
+        });
+    }
+    
+private:
+    struct StealRange {
+        atomic<uint64_t> range; //begin in the high half, end in the low half
+        char padding[64 - sizeof(atomic<uint64_t>)]; //Keeps each slot's range on its own cache line
+    };
+    
+    static uint64_t packRange(int begin, int end){
+        return ((uint64_t)(uint32_t)begin << 32) | (uint32_t)end;
+    }
+    
+    static int rangeBegin(uint64_t range){
+        return (int)(range >> 32);
+    }
+    
+    static int rangeEnd(uint64_t range){
+        return (int)(uint32_t)range;
+    }
+    
+
+    vector<thread> workers;
+    mutex runLock;
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+    
+    const function<void(int)> *job;
+    int numTasks;
+    atomic<int> nextTask;
+    int active;
+    unsigned generation;
+    bool stopping;
+    
+    static bool & insideTask(){
+        static thread_local bool inside = false;
+        return inside;
+    }
+    
+    void work(const function<void(int)> &task, int count){
+        insideTask() = true;
+        for(int i = nextTask++; i < count; i = nextTask++){
+            task(i);
+        }
+        insideTask() = false;
+    }
+    
+    void workerLoop(){
+        unsigned seen = 0;
+        unique_lock<mutex> guard(lock);
+        while(true){
+            wake.wait(guard, [&]{ return stopping || generation != seen; });
+            if(stopping)
+                return;
+            seen = generation;
+            const function<void(int)> &task = *job;
+            int count = numTasks;
+            
+            guard.unlock();
+            work(task, count);
+            guard.lock();
+            
+            if(--active == 0)
+                done.notify_all();
+        }
+    }
+};
+
+
+
+
+
+//MARK: Triplet
+/*
+One (row, col, value) entry used to build a SparseMatrix in bulk. DuplicatePolicy says how several
+Triplets for the same position are combined: added together, the last one given kept, or the largest kept.
+*/
+template <class T, class Index>
+struct BasicTriplet {
+    Index row;
+    Index col;
+    T value;
+    BasicTriplet(Index r=0, Index c=0, T v=T()){
+        row = r;
+        col = c;
+        value = v;
+    }
+};
+
+typedef BasicTriplet<double, int> Triplet;
+
+enum class DuplicatePolicy { Sum, Last, Max };
+
+
+
+
+
+//MARK: BlockKernel
+/*
+Dense micro-kernels for the fixed size blocks of a BlockSparseMatrix and the column panels of spmm. A block is stored column by column,
+so the kernels work down the R rows of a block in vector registers. A lane loads, scales and adds width
+values at once, adds and sums its own values, and gathers width values of an array at given indices for a SellMatrix
+and for the rows of a frozen matrix's spmv (RowDotKernel): ScalarLane is
+one value, Avx2Lane holds 4 doubles or 8 floats and Avx512Lane 8 doubles or 16 floats. BlockLane picks
+the widest lane whose width divides R among the instruction sets the header is compiled for (-mavx2 -mfma,
+-mavx512f or -march=native). Without them, and for other value types, the scalar lane is used and the
+compiler unrolls its fixed length loops.
+*/
+template <class T>
+struct ScalarLane {
+    typedef T Vector;
+    static const int width = 1;
+    static Vector load(const T *p){ return *p; }
+    static void store(T *p, Vector v){ *p = v; }
+    static Vector broadcast(T v){ return v; }
+    static Vector multiplyAdd(Vector a, Vector b, Vector c){ return a * b + c; }
+    static Vector add(Vector a, Vector b){ return a + b; }
+    static T sum(Vector v){ return v; }
+    template <class I> static Vector gather(const T *base, const I *indices){ return base[*indices]; }
+};
+
+#if defined(__AVX2__) && defined(__FMA__)
+template <class T> struct Avx2Lane;
+
+template <>
+struct Avx2Lane<double> {
+    typedef __m256d Vector;
+    static const int width = 4;
+    static Vector load(const double *p){ return _mm256_loadu_pd(p); }
+    static void store(double *p, Vector v){ _mm256_storeu_pd(p, v); }
+    static Vector broadcast(double v){ return _mm256_set1_pd(v); }
+    static Vector multiplyAdd(Vector a, Vector b, Vector c){ return _mm256_fmadd_pd(a, b, c); }
+    static Vector add(Vector a, Vector b){ return _mm256_add_pd(a, b); }
+    static double sum(Vector v){
+        __m128d half = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    }
+    static Vector all(){ return _mm256_castsi256_pd(_mm256_set1_epi64x(-1)); } //Gathers every lane
+    static Vector gather(const double *base, const int *indices){
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, _mm_loadu_si128((const __m128i *)indices), all(), 8);
+    }
+    static Vector gather(const double *base, const long long *indices){
+        return _mm256_mask_i64gather_pd(_mm256_setzero_pd(), base, _mm256_loadu_si256((const __m256i *)indices), all(), 8);
+    }
+    template <class I> static Vector gather(const double *base, const I *indices){
+        double gathered[width];
+        for(int i=0; i < width; i++){
+            gathered[i] = base[indices[i]];
+        }
+        return load(gathered);
+    }
+};
+
+template <>
+struct Avx2Lane<float> {
+    typedef __m256 Vector;
+    static const int width = 8;
+    static Vector load(const float *p){ return _mm256_loadu_ps(p); }
+    static void store(float *p, Vector v){ _mm256_storeu_ps(p, v); }
+    static Vector broadcast(float v){ return _mm256_set1_ps(v); }
+    static Vector multiplyAdd(Vector a, Vector b, Vector c){ return _mm256_fmadd_ps(a, b, c); }
+    static Vector add(Vector a, Vector b){ return _mm256_add_ps(a, b); }
+    static float sum(Vector v){
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        return _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+    }
+    static Vector all(){ return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); } //Gathers every lane
+    static Vector gather(const float *base, const int *indices){
+        return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, _mm256_loadu_si256((const __m256i *)indices), all(), 4);
+    }
+    template <class I> static Vector gather(const float *base, const I *indices){
+        float gathered[width];
+        for(int i=0; i < width; i++){
+            gathered[i] = base[indices[i]];
+        }
+        return load(gathered);
+    }
+};
+#endif
+
+#if defined(__AVX512F__)
+template <class T> struct Avx512Lane;
+
+template <>
+struct Avx512Lane<double> {
+    typedef __m512d Vector;
+    static const int width = 8;
+    static Vector load(const double *p){ return _mm512_loadu_pd(p); }
+    static void store(double *p, Vector v){ _mm512_storeu_pd(p, v); }
+    static Vector broadcast(double v){ return _mm512_set1_pd(v); }
+    static Vector multiplyAdd(Vector a, Vector b, Vector c){ return _mm512_fmadd_pd(a, b, c); }
+    static Vector add(Vector a, Vector b){ return _mm512_add_pd(a, b); }
+    static double sum(Vector v){ //Masked extracts, as the unmasked ones trip -Wmaybe-uninitialized in GCC's header
+        __m256d lower = _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, v, 0);
+        __m256d upper = _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, v, 1);
+        __m256d quarters = _mm256_add_pd(lower, upper);
+        __m128d half = _mm_add_pd(_mm256_castpd256_pd128(quarters), _mm256_extractf128_pd(quarters, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    }
+    static Vector gather(const double *base, const int *indices){
+        return _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, _mm256_loadu_si256((const __m256i *)indices), base, 8);
+    }
+    static Vector gather(const double *base, const long long *indices){
+        return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xFF, _mm512_loadu_si512(indices), base, 8);
+    }
+    template <class I> static Vector gather(const double *base, const I *indices){
+        double gathered[width];
+        for(int i=0; i < width; i++){
+            gathered[i] = base[indices[i]];
+        }
+        return load(gathered);
+    }
+};
+
+template <>
+struct Avx512Lane<float> {
+    typedef __m512 Vector;
+    static const int width = 16;
+    static Vector load(const float *p){ return _mm512_loadu_ps(p); }
+    static void store(float *p, Vector v){ _mm512_storeu_ps(p, v); }
+    static Vector broadcast(float v){ return _mm512_set1_ps(v); }
+    static Vector multiplyAdd(Vector a, Vector b, Vector c){ return _mm512_fmadd_ps(a, b, c); }
+    static Vector add(Vector a, Vector b){ return _mm512_add_ps(a, b); }
+    static float sum(Vector v){
+        __m256 lower = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, _mm512_castps_pd(v), 0));
+        __m256 upper = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, _mm512_castps_pd(v), 1));
+        __m256 quarters = _mm256_add_ps(lower, upper);
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(quarters), _mm256_extractf128_ps(quarters, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        return _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+    }
+    static Vector gather(const float *base, const int *indices){
+        return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, _mm512_loadu_si512(indices), base, 4);
+    }
+    template <class I> static Vector gather(const float *base, const I *indices){
+        float gathered[width];
+        for(int i=0; i < width; i++){
+            gathered[i] = base[indices[i]];
+        }
+        return load(gathered);
+    }
+};
+#endif
+
+template <class T, int R>
+struct BlockLane {
+    typedef ScalarLane<T> type;
+};
+
+#if defined(__AVX512F__) && defined(__AVX2__) && defined(__FMA__)
+template <int R>
+struct BlockLane<double, R> {
+    typedef typename conditional<R % 8 == 0, Avx512Lane<double>,
+            typename conditional<R % 4 == 0, Avx2Lane<double>, ScalarLane<double> >::type>::type type;
+};
+
+template <int R>
+struct BlockLane<float, R> {
+    typedef typename conditional<R % 16 == 0, Avx512Lane<float>,
+            typename conditional<R % 8 == 0, Avx2Lane<float>, ScalarLane<float> >::type>::type type;
+};
+#elif defined(__AVX2__) && defined(__FMA__)
+template <int R>
+struct BlockLane<double, R> {
+    typedef typename conditional<R % 4 == 0, Avx2Lane<double>, ScalarLane<double> >::type type;
+};
+
+template <int R>
+struct BlockLane<float, R> {
+    typedef typename conditional<R % 8 == 0, Avx2Lane<float>, ScalarLane<float> >::type type;
+};
+#endif
+
+template <class T, int R, int C>
+struct BlockKernel {
+    typedef typename BlockLane<T, R>::type Lane;
+    typedef typename Lane::Vector Vector;
+    
+    /*
+    Post: y[0..R) += block * x[0..C), where block is R x C
+    */
+    static void multiplyAdd(const T *block, const T *x, T *y){
+        for(int r=0; r < R; r += Lane::width){
+            Vector sum = Lane::load(y + r);
+            for(int c=0; c < C; c++){
+                sum = Lane::multiplyAdd(Lane::load(block + c * R + r), Lane::broadcast(x[c]), sum);
+            }
+            Lane::store(y + r, sum);
+        }
+    }
+    
+    /*
+    Post: out += lhs * rhs, where lhs is R x C, rhs is C x P and out is R x P. Each column of out is
+          lhs times the matching column of rhs.
+    */
+    template <int P>
+    static void multiplyAddBlock(const T *lhs, const T *rhs, T *out){
+        for(int p=0; p < P; p++){
+            multiplyAdd(lhs, rhs + p * C, out + p * R);
+        }
+    }
+};
+
+/*
+Kernel of spmm for a panel of W columns of a row-major dense matrix. A sparse row's sums for the panel are
+kept in W/width vector registers while its Elements are walked, so each Element is loaded once per panel
+and each row of x it selects is read as W contiguous values. BlockLane picks the lane as for a block of
+W rows.
+*/
+template <class T, int W>
+struct PanelKernel {
+    typedef typename BlockLane<T, W>::type Lane;
+    typedef typename Lane::Vector Vector;
+    
+    /*
+    Post: y[0..W) = alpha * (sum of values[i] * x[cols[i]*ldx ..+W) over the length Elements) + beta * y[0..W),
+          without reading y when beta is zero.
+    */
+    template <class Index>
+    static void multiply(const Index *cols, const T *values, size_t length, const T *x, size_t ldx, T *y, T alpha, T beta){
+        Vector sum[W / Lane::width];
+        for(int v=0; v < W / Lane::width; v++){
+            sum[v] = Lane::broadcast(T(0));
+        }
+        for(size_t i=0; i < length; i++){
+            Vector value = Lane::broadcast(values[i]);
+            const T *row = x + (size_t)cols[i] * ldx;
+            for(int v=0; v < W / Lane::width; v++){
+                sum[v] = Lane::multiplyAdd(value, Lane::load(row + v * Lane::width), sum[v]);
+            }
+        }
+        for(int v=0; v < W / Lane::width; v++){
+            Vector scaled = Lane::broadcast(T(0));
+            if(beta != 0)
+                scaled = Lane::multiplyAdd(Lane::broadcast(beta), Lane::load(y + v * Lane::width), scaled);
+            Lane::store(y + v * Lane::width, Lane::multiplyAdd(Lane::broadcast(alpha), sum[v], scaled));
+        }
+    }
+};
+
+/*
+Kernel of a frozen matrix's spmv: the dot product of one compressed row with a dense vector. The row's
+values are loaded and the x values its columns select are gathered width at a time, into four independent
+sums so several gathers and multiply-adds are in flight, with a scalar loop for the last few Elements. It
+uses the widest lane available for T.
+*/
+template <class T>
+struct RowDotKernel {
+    typedef typename BlockLane<T, 16>::type Lane;
+    typedef typename Lane::Vector Vector;
+    
+    template <class Index>
+    static T dot(const Index *cols, const T *values, size_t length, const T *x){
+        const int width = Lane::width;
+        size_t i = 0;
+        T total = 0;
+        if(length >= (size_t)width){ //Rows shorter than one vector skip straight to the scalar loop
+            Vector sum0 = Lane::broadcast(T(0)), sum1 = sum0, sum2 = sum0, sum3 = sum0;
+            for(; i + 4 * width <= length; i += 4 * width){
+                sum0 = Lane::multiplyAdd(Lane::load(values + i), Lane::gather(x, cols + i), sum0);
+                sum1 = Lane::multiplyAdd(Lane::load(values + i + width), Lane::gather(x, cols + i + width), sum1);
+                sum2 = Lane::multiplyAdd(Lane::load(values + i + 2 * width), Lane::gather(x, cols + i + 2 * width), sum2);
+                sum3 = Lane::multiplyAdd(Lane::load(values + i + 3 * width), Lane::gather(x, cols + i + 3 * width), sum3);
+            }
+            if(i + 2 * width <= length){ //What is left after the unrolled loop still goes to separate sums
+                sum0 = Lane::multiplyAdd(Lane::load(values + i), Lane::gather(x, cols + i), sum0);
+                sum1 = Lane::multiplyAdd(Lane::load(values + i + width), Lane::gather(x, cols + i + width), sum1);
+                i += 2 * width;
+            }
+            for(; i + width <= length; i += width){
+                sum2 = Lane::multiplyAdd(Lane::load(values + i), Lane::gather(x, cols + i), sum2);
+            }
+            total = Lane::sum(Lane::add(Lane::add(sum0, sum1), Lane::add(sum2, sum3)));
+        }
+        T tail0 = 0, tail1 = 0;
+        for(; i + 2 <= length; i += 2){
+            tail0 += values[i] * x[cols[i]];
+            tail1 += values[i+1] * x[cols[i+1]];
+        }
+        if(i < length)
+            tail0 += values[i] * x[cols[i]];
+        return total + (tail0 + tail1);
+    }
+};
+
+/*
+The block size detectBlockShape suggests for a matrix, and the fraction of the block values which
+would hold an Element.
+*/
+struct BlockShape {
+    int rows;
+    int cols;
+    double fill;
+};
+
+
+
+
+
+//MARK: MatrixExpression
+/*
+Lazy matrix expressions. a*b, a+b, a-b, alpha*a and a.tr() do not compute anything; they return small
+objects which remember the operands, and the whole expression is evaluated in one go when it is assigned
+to, or used to construct, a SparseMatrix. This lets the evaluator fuse operations which would otherwise
+each build a full temporary matrix:
+  + a*b + c and c - a*b seed every row's SpGEMM accumulator with the row of c
+  + alpha*(a*b) and (alpha*a)*b scale the product while it is being accumulated
+  + (a*b).tr() is computed as b.tr() * a.tr(), so the product is built straight in transposed order
+Matrices are held by reference and expressions by value, so an expression must be evaluated before the
+matrices it refers to are destroyed, normally in the same statement.
+*/
+template <class Derived, class Matrix> struct MatrixExpression;
+template <class L, class R> struct MatrixProduct;
+template <class L, class R> struct MatrixSum;
+template <class E> struct MatrixScaled;
+template <class E> struct MatrixTranspose;
+
+/*
+Says how an operand is held inside an expression, and which matrix type the expression evaluates to.
+Only matrices and expressions have a MatrixOperand, so the operators below ignore every other type.
+*/
+template <class E, class Enable = void>
+struct MatrixOperand {};
+
+template <class T, class Index>
+struct MatrixOperand<BasicSparseMatrix<T, Index> > {
+    typedef BasicSparseMatrix<T, Index> Matrix;
+    typedef const Matrix & Stored; //Matrices are referred to, never copied
+};
+
+template <class E>
+struct MatrixOperand<E, typename enable_if<is_base_of<MatrixExpression<E, typename E::Matrix>, E>::value>::type> {
+    typedef typename E::Matrix Matrix;
+    typedef E Stored;
+};
+
+/*
+Post: value is true for a product, possibly scaled, which a sum can fuse with its other operand.
+*/
+template <class E> struct IsProductTerm : false_type {};
+template <class L, class R> struct IsProductTerm<MatrixProduct<L, R> > : true_type {};
+template <class E> struct IsProductTerm<MatrixScaled<E> > : IsProductTerm<E> {};
+
+template <class Derived, class Matrix>
+struct MatrixExpression {
+    /*
+    Post: returns the lazy transpose of the expression
+    */
+    MatrixTranspose<Derived> tr() const {
+        return MatrixTranspose<Derived>(static_cast<const Derived &>(*this));
+    }
+    
+    /*
+    Post: returns the value of the expression as a matrix
+    */
+    Matrix eval() const {
+        return Matrix(static_cast<const Derived &>(*this));
+    }
+};
+
+template <class L, class R>
+struct MatrixProduct : MatrixExpression<MatrixProduct<L, R>, typename MatrixOperand<L>::Matrix> {
+    typedef typename MatrixOperand<L>::Matrix Matrix;
+    typename MatrixOperand<L>::Stored lhs;
+    typename MatrixOperand<R>::Stored rhs;
+    MatrixProduct(const L &lhs, const R &rhs) : lhs(lhs), rhs(rhs) {}
+};
+
+/*
+alpha*lhs + beta*rhs, so subtraction is a sum with beta = -1.
+*/
+template <class L, class R>
+struct MatrixSum : MatrixExpression<MatrixSum<L, R>, typename MatrixOperand<L>::Matrix> {
+    typedef typename MatrixOperand<L>::Matrix Matrix;
+    typename MatrixOperand<L>::Stored lhs;
+    typename MatrixOperand<R>::Stored rhs;
+    typename Matrix::Value alpha;
+    typename Matrix::Value beta;
+    MatrixSum(const L &lhs, const R &rhs, typename Matrix::Value alpha, typename Matrix::Value beta)
+        : lhs(lhs), rhs(rhs), alpha(alpha), beta(beta) {}
+};
+
+template <class E>
+struct MatrixScaled : MatrixExpression<MatrixScaled<E>, typename MatrixOperand<E>::Matrix> {
+    typedef typename MatrixOperand<E>::Matrix Matrix;
+    typename MatrixOperand<E>::Stored operand;
+    typename Matrix::Value alpha;
+    MatrixScaled(const E &operand, typename Matrix::Value alpha) : operand(operand), alpha(alpha) {}
+};
+
+template <class E>
+struct MatrixTranspose : MatrixExpression<MatrixTranspose<E>, typename MatrixOperand<E>::Matrix> {
+    typedef typename MatrixOperand<E>::Matrix Matrix;
+    typename MatrixOperand<E>::Stored operand;
+    explicit MatrixTranspose(const E &operand) : operand(operand) {}
+};
+
+/*
+Post: return the lazy expressions lhs*rhs, lhs+rhs, lhs-rhs and alpha*expression. Both operands of a
+      binary operator must evaluate to the same matrix type.
+*/
+template <class L, class R>
+typename enable_if<is_same<typename MatrixOperand<L>::Matrix, typename MatrixOperand<R>::Matrix>::value, MatrixProduct<L, R> >::type
+operator * (const L &lhs, const R &rhs){
+    return MatrixProduct<L, R>(lhs, rhs);
+}
+
+template <class L, class R>
+typename enable_if<is_same<typename MatrixOperand<L>::Matrix, typename MatrixOperand<R>::Matrix>::value, MatrixSum<L, R> >::type
+operator + (const L &lhs, const R &rhs){
+    return MatrixSum<L, R>(lhs, rhs, 1, 1);
+}
+
+template <class L, class R>
+typename enable_if<is_same<typename MatrixOperand<L>::Matrix, typename MatrixOperand<R>::Matrix>::value, MatrixSum<L, R> >::type
+operator - (const L &lhs, const R &rhs){
+    return MatrixSum<L, R>(lhs, rhs, 1, -1);
+}
+
+template <class E>
+MatrixScaled<E> operator * (typename MatrixOperand<E>::Matrix::Value alpha, const E &expression){
+    return MatrixScaled<E>(expression, alpha);
+}
+
+template <class E>
+MatrixScaled<E> operator * (const E &expression, typename MatrixOperand<E>::Matrix::Value alpha){
+    return MatrixScaled<E>(expression, alpha);
+}
+
+/*
+Prints out the value of an expression
+*/
+template <class Derived, class Matrix>
+ostream &operator << (ostream &out, const MatrixExpression<Derived, Matrix> &expression){
+    return out << expression.eval();
+}
+
+
+
+
+
+//MARK: Reordering
+/*
+The permutations reordered() can pick for a square matrix. ReverseCuthillMcKee numbers the rows breadth
+first from a row at the edge of the matrix's graph, which keeps Elements close to the diagonal: a small
+bandwidth and profile, so spmv reads nearby parts of x and multiply reads nearby rows. Degree puts the rows
+with the most Elements first, which gathers the hubs of a power-law graph into one part of x.
+*/
+enum class Ordering { ReverseCuthillMcKee, Degree };
+
+/*
+A matrix with its rows and columns permuted, as returned by reordered(). Row i of matrix is row rowOrder[i]
+of the original and column j is column colOrder[j]. The bandwidth and profile of the original and the
+permuted matrix show how much closer to the diagonal the Elements moved.
+*/
+template <class T, class Index>
+struct BasicReordering {
+    BasicSparseMatrix<T, Index> matrix;
+    vector<Index> rowOrder;
+    vector<Index> colOrder;
+    Index bandwidthBefore;
+    Index bandwidthAfter;
+    size_t profileBefore;
+    size_t profileAfter;
+};
+
+typedef BasicReordering<double, int> Reordering;
+
+
+
+
+
+//MARK: Semiring
+/*
+The (add, multiply) pairs multiplyOver() and maskedProduct() compute products in. A semiring is a struct of
+static functions: zero() is the identity of add, which an absent Element stands for and which a product
+never stores, one() is the identity of multiply, and add and multiply combine two values. When
+hasAnnihilator is true, annihilator() is a value add never moves away from, so a sum which reaches it is
+left alone. The kernels are templates over the semiring, so these calls are inlined and a product in
+PlusTimes compiles to the same loops as plain arithmetic.
+*/
+template <class T>
+struct PlusTimes { //Ordinary arithmetic
+    static const bool hasAnnihilator = false;
+    static T zero(){ return T(0); }
+    static T one(){ return T(1); }
+    static T annihilator(){ return T(0); }
+    static T add(T a, T b){ return a + b; }
+    static T multiply(T a, T b){ return a * b; }
+};
+
+template <class T>
+struct MinPlus { //Shortest paths: Elements are edge lengths and a product holds the shortest two step paths
+    static const bool hasAnnihilator = false;
+    static T zero(){ return numeric_limits<T>::has_infinity ? numeric_limits<T>::infinity() : numeric_limits<T>::max(); }
+    static T one(){ return T(0); }
+    static T annihilator(){ return zero(); }
+    static T add(T a, T b){ return min(a, b); }
+    static T multiply(T a, T b){ //Without an infinity, the largest value stands for one and must not overflow
+        return numeric_limits<T>::has_infinity || (a != zero() && b != zero()) ? a + b : zero();
+    }
+};
+
+template <class T>
+struct MaxTimes { //Most likely paths, for Elements which are probabilities or other nonnegative weights
+    static const bool hasAnnihilator = false;
+    static T zero(){ return T(0); }
+    static T one(){ return T(1); }
+    static T annihilator(){ return T(0); }
+    static T add(T a, T b){ return max(a, b); }
+    static T multiply(T a, T b){ return a * b; }
+};
+
+template <class T>
+struct OrAnd { //Reachability: any nonzero is true, and a product holds 1 where a two step path exists
+    static const bool hasAnnihilator = true; //Once a sum is true no other path changes it
+    static T zero(){ return T(0); }
+    static T one(){ return T(1); }
+    static T annihilator(){ return T(1); }
+    static T add(T a, T b){ return a != T(0) || b != T(0) ? T(1) : T(0); }
+    static T multiply(T a, T b){ return a != T(0) && b != T(0) ? T(1) : T(0); }
+};
+
+
+
+
+
+//MARK: Mask
+/*
+Which entries of a product maskedProduct() computes, given a mask matrix. Values keeps the positions where
+the mask holds a nonzero value and Structure every position where it stores an Element, zero or not. The
+Complement modes keep every other position instead.
+*/
+enum class MaskMode { Values, Structure, ComplementValues, ComplementStructure };
+
+
+
+
+
+//MARK: SparseMatrix
+template <class T, class Index>
+class BasicSparseMatrix {
+public:
+    typedef BasicElement<T, Index> Element;
+    typedef BasicElementPool<T, Index> ElementPool;
+    typedef BasicElementList<T, Index> ElementList;
+    typedef BasicCompressedStorage<T, Index> CompressedStorage;
+    typedef BasicRowView<T, Index> RowView;
+    typedef BasicRowReference<T, Index> RowReference;
+    typedef BasicTriplet<T, Index> Triplet;
+    typedef T Value;
+    
+/* ---Constructors and Destructors--- */
+    /*
+    Every row allocates its Elements from pool, so a matrix's Elements share a few large slabs. A pool
+    of a different ElementPool subclass can be passed in to change how Elements are allocated.
+    */
+    BasicSparseMatrix(Index n=0, Index m=0, const shared_ptr<ElementPool> &pool=make_shared<ElementPool>()){
+        numRows = n;
+        numCols = m;
+        compressed = false;
+        this->pool = pool;
+        newRows();
+    }
+    
+    BasicSparseMatrix(const BasicSparseMatrix &rhs){ //Deep Copy Constructor, allocating from a new pool of rhs's kind
+        SPARSEMATRIX_TIME(Copy);
+        numRows = rhs.numRows;
+        numCols = rhs.numCols;
+        compressed = rhs.compressed;
+        csr = rhs.csr;
+        pool = newPoolFor(rhs.pool);
+        rows = nullptr;
+        if(!compressed){
+            newRows();
+            for(Index i=0; i < rhs.numRows; i++){
+                rows[i] = rhs.rows[i];
+            }
+        }
+    }
+    
+    BasicSparseMatrix(BasicSparseMatrix &&rhs){ //Move Constructor, takes over rhs's rows and leaves it an empty 0x0 matrix
+        numRows = rhs.numRows;
+        numCols = rhs.numCols;
+        compressed = rhs.compressed;
+        csr = move(rhs.csr);
+        pool = move(rhs.pool);
+        rows = rhs.rows;
+        rhs.numRows = 0;
+        rhs.numCols = 0;
+        rhs.compressed = false;
+        rhs.rows = nullptr;
+    }
+    
+    /*
+    Evaluates a lazy expression such as a*b + c or (a*b).tr() into a new matrix (see MatrixExpression).
+    */
+    template <class Derived>
+    BasicSparseMatrix(const MatrixExpression<Derived, BasicSparseMatrix> &expression)
+        : BasicSparseMatrix(evaluate(static_cast<const Derived &>(expression))) {}
+    
+    ~BasicSparseMatrix(){ //Destructor
+        deleteRows();
+    }
+    
+    /*
+    Builds a matrix from count (row, col, value) triplets given in any order, stored in three arrays.
+    The triplets are bucketed by row with a counting sort, each row is sorted by column, and Elements
+    sharing a position are merged using policy. Large inputs are split over the WorkerPool.
+    Pre:  every row is in [0, n) and every col is in [0, m).
+    Post: returns the n x m matrix holding the triplets, frozen. Call thaw() on it before editing.
+    */
+    static BasicSparseMatrix fromTriplets(Index n, Index m, const Index *rowIdx, const Index *colIdx, const T *values,
+                                     size_t count, DuplicatePolicy policy=DuplicatePolicy::Sum){
+        CompressedStorage csr;
+        WorkerPool &pool = WorkerPool::shared();
+        
+        //Every chunk of the input keeps its own row histogram, so only use as many chunks as the
+        //input is large compared to the number of rows
+        size_t numChunks = count < parallelThreshold ? 1 : min((size_t)pool.size() * 4, count / ((size_t)n + 1));
+        numChunks = max(numChunks, (size_t)1);
+        vector<size_t> histograms(numChunks * (n + 1), 0);
+        
+        pool.run((int)numChunks, [&](int chunk){
+            size_t *histogram = &histograms[chunk * (n + 1)];
+            for(size_t i = count * chunk / numChunks; i < count * (chunk + 1) / numChunks; i++){
+                histogram[rowIdx[i]]++;
+            }
+        });
+        
+        //Turn the counts into the position where each chunk's first triplet of each row goes. Chunks are
+        //laid out in input order inside a row so the sort is stable, which DuplicatePolicy::Last relies on.
+        vector<size_t> starts(n + 1);
+        size_t total = 0;
+        for(Index row=0; row < n; row++){
+            starts[row] = total;
+            for(size_t chunk=0; chunk < numChunks; chunk++){
+                size_t rowCount = histograms[chunk * (n + 1) + row];
+                histograms[chunk * (n + 1) + row] = total;
+                total += rowCount;
+            }
+        }
+        starts[n] = total;
+        
+        vector<Index> bucketCols(count);
+        vector<T> bucketValues(count);
+        pool.run((int)numChunks, [&](int chunk){
+            size_t *next = &histograms[chunk * (n + 1)];
+            for(size_t i = count * chunk / numChunks; i < count * (chunk + 1) / numChunks; i++){
+                size_t pos = next[rowIdx[i]]++;
+                bucketCols[pos] = colIdx[i];
+                bucketValues[pos] = values[i];
+            }
+        });
+        
+        //Sort every row by column and merge duplicates in place, at the front of the row's bucket
+        vector<size_t> lengths(n + 1, 0);
+        int numBlocks = (int)numChunks;
+        pool.run(numBlocks, [&](int block){
+            vector<pair<Index, T> > row;
+            for(Index r = (Index)((size_t)n * block / numBlocks); r < (Index)((size_t)n * (block + 1) / numBlocks); r++){
+                row.assign(starts[r+1] - starts[r], pair<Index, T>());
+                for(size_t i = starts[r]; i < starts[r+1]; i++){
+                    row[i - starts[r]] = make_pair(bucketCols[i], bucketValues[i]);
+                }
+                sortByColumn(row);
+                
+                size_t length = 0;
+                for(size_t i=0; i < row.size(); i++){
+                    size_t pos = starts[r] + length;
+                    if(length > 0 && bucketCols[pos-1] == row[i].first){
+                        T &merged = bucketValues[pos-1];
+                        if(policy == DuplicatePolicy::Sum)
+                            merged += row[i].second;
+                        else if(policy == DuplicatePolicy::Last)
+                            merged = row[i].second;
+                        else
+                            merged = max(merged, row[i].second);
+                    }
+                    else{
+                        bucketCols[pos] = row[i].first;
+                        bucketValues[pos] = row[i].second;
+                        length++;
+                    }
+                }
+                lengths[r+1] = length;
+            }
+        });
+        
+        //Close the gaps left by merged duplicates
+        csr.offsets.assign(n + 1, 0);
+        for(Index row=0; row < n; row++){
+            csr.offsets[row+1] = csr.offsets[row] + lengths[row+1];
+        }
+        csr.indices.resize(csr.offsets[n]);
+        csr.values.resize(csr.offsets[n]);
+        pool.run(numBlocks, [&](int block){
+            for(Index r = (Index)((size_t)n * block / numBlocks); r < (Index)((size_t)n * (block + 1) / numBlocks); r++){
+                copy(bucketCols.begin() + starts[r], bucketCols.begin() + starts[r] + lengths[r+1], csr.indices.data() + csr.offsets[r]);
+                copy(bucketValues.begin() + starts[r], bucketValues.begin() + starts[r] + lengths[r+1], csr.values.data() + csr.offsets[r]);
+            }
+        });
+        
+        return BasicSparseMatrix(n, m, move(csr));
+    }
+    
+    
+    /*
+    Builds a matrix from a range of Triplets (or any objects with row, col and value members) in any order.
+    Pre:  every row is in [0, n) and every col is in [0, m).
+    Post: returns the n x m matrix holding the triplets, frozen. Call thaw() on it before editing.
+    */
+    template <class Iterator>
+    static BasicSparseMatrix fromTriplets(Index n, Index m, Iterator first, Iterator last, DuplicatePolicy policy=DuplicatePolicy::Sum){
+        vector<Index> rowIdx;
+        vector<Index> colIdx;
+        vector<T> values;
+        for(; first != last; ++first){
+            rowIdx.push_back(first->row);
+            colIdx.push_back(first->col);
+            values.push_back(first->value);
+        }
+        return fromTriplets(n, m, rowIdx.data(), colIdx.data(), values.data(), values.size(), policy);
+    }
+    
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Converts the matrix into compressed sparse row form. Every row's Elements are moved into three
+    contiguous arrays and the linked lists are released, so a frozen matrix uses about a third of the
+    memory and is scanned sequentially by multiply, transpose, printing and element reads.
+    Post: the matrix is frozen. Calling freeze on a frozen matrix does nothing.
+    */
+    void freeze(){
+        if(compressed)
+            return;
+        
+        size_t nnz = 0;
+        for(Index row=0; row < numRows; row++){
+            for(Element *ptr = rows[row].getList(); ptr != nullptr; ptr = ptr->next){
+                nnz++;
+            }
+        }
+        
+        csr.offsets.resize(numRows + 1);
+        csr.indices.resize(nnz);
+        csr.values.resize(nnz);
+        size_t pos = 0;
+        for(Index row=0; row < numRows; row++){
+            csr.offsets[row] = pos;
+            for(Element *ptr = rows[row].getList(); ptr != nullptr; ptr = ptr->next){
+                csr.indices[pos] = ptr->col;
+                csr.values[pos] = ptr->value;
+                pos++;
+            }
+        }
+        csr.offsets[numRows] = pos;
+        
+        deleteRows();
+        compressed = true;
+    }
+    
+    
+    /*
+    Converts a frozen matrix back into linked list rows so it can be edited.
+    Post: the matrix is no longer frozen. Calling thaw on a matrix which is not frozen does nothing.
+    */
+    void thaw(){
+        if(!compressed)
+            return;
+        
+        newRows();
+        for(Index row=0; row < numRows; row++){
+            Element *tail = nullptr;
+            for(size_t i = csr.offsets[row]; i < csr.offsets[row+1]; i++){
+                tail = rows[row].append(tail, csr.indices[i], csr.values[i]);
+            }
+        }
+        
+        csr.clear();
+        compressed = false;
+    }
+    
+    
+    /*
+    Builds the index of every row long enough to have one (see ElementList::buildIndex), so random reads of a
+    const matrix look columns up instead of walking the rows. Rows which are edited keep their index up to
+    date, or drop it when they are rebuilt in bulk by axpy or a copy. Does nothing to a frozen matrix.
+    */
+    void indexRows(){
+        if(compressed)
+            return;
+        WorkerPool &pool = WorkerPool::shared();
+        int numBlocks = (int)min((size_t)numRows, (size_t)pool.size() * 4);
+        pool.run(numBlocks, [&](int block){
+            for(Index row = (Index)((size_t)numRows * block / numBlocks); row < (Index)((size_t)numRows * (block + 1) / numBlocks); row++){
+                rows[row].buildIndex();
+            }
+        });
+    }
+    
+    
+    /*
+    Post: returns true if the matrix is currently stored in compressed sparse row form.
+    */
+    bool isFrozen() const {
+        return compressed;
+    }
+    
+    
+    /*
+    Post: returns the number of Elements stored in the matrix.
+    */
+    size_t nonZeros() const {
+        if(compressed)
+            return csr.size();
+        
+        size_t nnz = 0;
+        for(Index row=0; row < numRows; row++){
+            forEachInRow(row, [&](Index, T){ nnz++; });
+        }
+        return nnz;
+    }
+    
+    
+    /*
+    Pre:  the matrix is frozen.
+    Post: returns the compressed sparse row arrays of the matrix.
+    */
+    const CompressedStorage & compressedRows() const {
+        return csr;
+    }
+    
+    
+    /*
+    Builds the compressed sparse column form of the matrix, in which offsets are indexed by column and
+    indices hold row numbers. This is a counting sort: one pass counts the Elements of every column and a
+    second scatters each Element to its column. Large matrices split their rows into blocks on the
+    WorkerPool, each block counting into its own histogram. Works on frozen and unfrozen matrices alike.
+    Post: returns the matrix's Elements grouped by column, with rows in increasing order in each column.
+    */
+    CompressedStorage compressColumns() const {
+        CompressedStorage csc;
+        WorkerPool &pool = WorkerPool::shared();
+        size_t nnz = nonZeros();
+        
+        //Each block needs a histogram as long as a row, so only use as many blocks as there are Elements per column
+        int numBlocks = 1;
+        if(nnz >= parallelThreshold)
+            numBlocks = (int)max((size_t)1, min((size_t)pool.size() * 4, nnz / ((size_t)numCols + 1)));
+        vector<Index> blocks = partitionRows(numBlocks);
+        vector<size_t> histograms((size_t)numBlocks * (numCols + 1), 0);
+        
+        //Count how many Elements of each block fall in each column
+        pool.run(numBlocks, [&](int block){
+            size_t *histogram = &histograms[(size_t)block * (numCols + 1)];
+            for(Index row = blocks[block]; row < blocks[block+1]; row++){
+                forEachInRow(row, [&](Index col, T){ histogram[col]++; });
+            }
+        });
+        
+        //Turn the counts into the position each block writes its first Element of a column to. Blocks
+        //hold increasing rows, so laying them out in order keeps each column sorted by row.
+        csc.offsets.assign(numCols + 1, 0);
+        size_t total = 0;
+        for(Index col=0; col < numCols; col++){
+            csc.offsets[col] = total;
+            for(int block=0; block < numBlocks; block++){
+                size_t count = histograms[(size_t)block * (numCols + 1) + col];
+                histograms[(size_t)block * (numCols + 1) + col] = total;
+                total += count;
+            }
+        }
+        csc.offsets[numCols] = total;
+        
+        csc.indices.resize(total);
+        csc.values.resize(total);
+        pool.run(numBlocks, [&](int block){
+            size_t *next = &histograms[(size_t)block * (numCols + 1)];
+            for(Index row = blocks[block]; row < blocks[block+1]; row++){
+                forEachInRow(row, [&](Index col, T value){
+                    size_t pos = next[col]++;
+                    csc.indices[pos] = row;
+                    csc.values[pos] = value;
+                });
+            }
+        });
+        return csc;
+    }
+    
+    
+    /*
+    Returns the value stored at (row,col) without creating an Element. A frozen row is binary searched.
+    Pre:  row and col must be within the SparseMatrix's range
+    Post: returns the value at (row,col), or zero if no Element exists there
+    */
+    T at(Index row, Index col) const {
+        return rowView(row)[col];
+    }
+    
+    
+    /*
+    Picks the square block size, out of 1, 2, 3, 4, 6 and 8, which would store the matrix in the fewest
+    bytes as a BlockSparseMatrix. A block costs R*C values and one index however many Elements it holds,
+    so larger blocks only win when they are mostly full. A size of 1 means the matrix is best kept as it is.
+    Post: returns the block size and the fraction of the blocks' values which would hold an Element
+    */
+    BlockShape detectBlockShape() const {
+        static const int sizes[] = {2, 3, 4, 6, 8};
+        size_t nnz = nonZeros();
+        BlockShape best = {1, 1, 1.};
+        double bestBytes = (double)nnz * (sizeof(T) + sizeof(Index)) + (double)numRows * sizeof(size_t);
+        for(int size : sizes){
+            vector<Index> marker((numCols + size - 1) / size, -1); //The last block row which used each block column
+            size_t numBlocks = 0;
+            for(Index row=0; row < numRows; row++){
+                forEachInRow(row, [&](Index col, T){
+                    if(marker[col / size] != row / size){
+                        marker[col / size] = row / size;
+                        numBlocks++;
+                    }
+                });
+            }
+            double bytes = (double)numBlocks * (size * size * sizeof(T) + sizeof(Index)) + (double)(numRows / size + 1) * sizeof(size_t);
+            if(bytes < bestBytes){
+                bestBytes = bytes;
+                best.rows = best.cols = size;
+                best.fill = (double)nnz / ((double)numBlocks * size * size);
+            }
+        }
+        return best;
+    }
+    
+    
+    /*
+    Converts the matrix to the BlockSparseMatrix picked by detectBlockShape and calls visitor with it. As the
+    block size is only known at run time, visitor must accept a BasicBlockSparseMatrix<T, Index, B, B> for
+    each B in 1, 2, 3, 4, 6 and 8, for example through a templated operator().
+    */
+    template <class Visitor>
+    void visitBlocks(Visitor &&visitor) const {
+        switch(detectBlockShape().rows){
+            case 2: visitor(BasicBlockSparseMatrix<T, Index, 2, 2>(*this)); break;
+            case 3: visitor(BasicBlockSparseMatrix<T, Index, 3, 3>(*this)); break;
+            case 4: visitor(BasicBlockSparseMatrix<T, Index, 4, 4>(*this)); break;
+            case 6: visitor(BasicBlockSparseMatrix<T, Index, 6, 6>(*this)); break;
+            case 8: visitor(BasicBlockSparseMatrix<T, Index, 8, 8>(*this)); break;
+            default: visitor(BasicBlockSparseMatrix<T, Index, 1, 1>(*this)); break;
+        }
+    }
+    
+    
+    /*
+    Post: returns the largest distance of an Element from the diagonal, |row - col|, or zero for an empty matrix.
+    */
+    Index bandwidth() const {
+        Index widest = 0;
+        for(Index row=0; row < numRows; row++){
+            forEachInRow(row, [&](Index col, T){ widest = max(widest, row > col ? row - col : col - row); });
+        }
+        return widest;
+    }
+    
+    
+    /*
+    Post: returns the profile (envelope size) of the matrix: the sum over the rows of how far left of the
+          diagonal the row's first Element is.
+    */
+    size_t profile() const {
+        size_t total = 0;
+        for(Index row=0; row < numRows; row++){
+            Index first = row;
+            if(compressed){
+                if(csr.offsets[row] < csr.offsets[row+1])
+                    first = min(first, csr.indices[csr.offsets[row]]);
+            }
+            else if(rows[row].getList() != nullptr)
+                first = min(first, rows[row].getList()->col);
+            total += (size_t)(row - first);
+        }
+        return total;
+    }
+    
+    
+    /*
+    Computes a Reverse Cuthill-McKee ordering of the graph of the matrix's Elements, taken as undirected so
+    an unsymmetric matrix is ordered by the pattern of self + self.tr(). Each connected part of the graph is
+    numbered breadth first from a pseudo-peripheral row, found by repeatedly starting from a row of lowest
+    degree in the last level of the previous search (George and Liu), and the neighbours of each row are
+    numbered in increasing order of degree. The whole numbering is then reversed.
+    Pre:  the matrix is square.
+    Post: returns the ordering, element i being the row (and column) which moves to position i.
+    */
+    vector<Index> reverseCuthillMcKee() const {
+        vector<size_t> offsets;
+        vector<Index> adjacent;
+        symmetricPattern(offsets, adjacent);
+        vector<Index> byDegree = orderedByDegree(offsets, false);
+        auto lessDegree = [&](Index a, Index b){
+            size_t degreeA = offsets[a+1] - offsets[a], degreeB = offsets[b+1] - offsets[b];
+            return degreeA < degreeB || (degreeA == degreeB && a < b);
+        };
+        
+        vector<Index> order;
+        order.reserve(numRows);
+        vector<Index> level(numRows, -1); //Scratch for pseudoPeripheral, always reset to -1
+        vector<bool> numbered(numRows, false);
+        for(Index i=0; i < numRows; i++){
+            if(numbered[byDegree[i]])
+                continue;
+            Index root = pseudoPeripheral(byDegree[i], offsets, adjacent, level);
+            size_t head = order.size();
+            order.push_back(root);
+            numbered[root] = true;
+            while(head < order.size()){
+                Index row = order[head++];
+                size_t first = order.size();
+                for(size_t k = offsets[row]; k < offsets[row+1]; k++){
+                    if(!numbered[adjacent[k]]){
+                        numbered[adjacent[k]] = true;
+                        order.push_back(adjacent[k]);
+                    }
+                }
+                sort(order.begin() + first, order.end(), lessDegree);
+            }
+        }
+        reverse(order.begin(), order.end());
+        return order;
+    }
+    
+    
+    /*
+    Orders the rows by their degree in the graph of self + self.tr(), most neighbours first, keeping rows of
+    equal degree in their original order.
+    Pre:  the matrix is square.
+    Post: returns the ordering, element i being the row (and column) which moves to position i.
+    */
+    vector<Index> degreeOrder() const {
+        vector<size_t> offsets;
+        vector<Index> adjacent;
+        symmetricPattern(offsets, adjacent);
+        return orderedByDegree(offsets, true);
+    }
+    
+    
+    /*
+    Permutes the rows and columns of the matrix: row i of the result is row rowOrder[i] of self, and column j
+    is column colOrder[j]. Each row is gathered and sorted by its new columns on the WorkerPool. The result is
+    frozen if self is, and made of ElementLists otherwise.
+    Pre:  rowOrder is a permutation of 0..numRows-1 and colOrder one of 0..numCols-1.
+    Post: returns the permuted matrix.
+    */
+    BasicSparseMatrix permuted(const vector<Index> &rowOrder, const vector<Index> &colOrder) const {
+        vector<Index> newCol(numCols);
+        for(Index col=0; col < numCols; col++){
+            newCol[colOrder[col]] = col;
+        }
+        CompressedStorage storage;
+        storage.offsets.assign(numRows + 1, 0);
+        for(Index row=0; row < numRows; row++){
+            size_t length = 0;
+            forEachInRow(rowOrder[row], [&](Index, T){ length++; });
+            storage.offsets[row+1] = storage.offsets[row] + length;
+        }
+        vector<Index> cols(storage.offsets[numRows]);
+        vector<T> values(storage.offsets[numRows]);
+        
+        WorkerPool &pool = WorkerPool::shared();
+        int numBlocks = storage.offsets[numRows] < parallelThreshold ? 1 : (int)pool.size() * 4;
+        vector<Index> blocks = partitionByPrefix(storage.offsets.data(), numRows, numBlocks);
+        pool.run(numBlocks, [&](int block){
+            vector<pair<Index, T> > row;
+            for(Index i = blocks[block]; i < blocks[block+1]; i++){
+                row.clear();
+                forEachInRow(rowOrder[i], [&](Index col, T value){ row.push_back(make_pair(newCol[col], value)); });
+                sortByColumn(row);
+                for(size_t k=0; k < row.size(); k++){
+                    cols[storage.offsets[i] + k] = row[k].first;
+                    values[storage.offsets[i] + k] = row[k].second;
+                }
+            }
+        });
+        storage.indices.assign(move(cols));
+        storage.values.assign(move(values));
+        
+        BasicSparseMatrix newMatrix(numRows, numCols, move(storage), this->pool);
+        if(!compressed)
+            newMatrix.thaw();
+        return newMatrix;
+    }
+    
+    /*
+    Post: returns the matrix with its rows and columns both permuted by order (see permuted above).
+    */
+    BasicSparseMatrix permuted(const vector<Index> &order) const {
+        return permuted(order, order);
+    }
+    
+    
+    /*
+    Reorders a square matrix symmetrically with reverseCuthillMcKee or degreeOrder.
+    Post: returns the permuted matrix, the ordering as its row and column order, and the bandwidth and
+          profile before and after.
+    */
+    BasicReordering<T, Index> reordered(Ordering ordering=Ordering::ReverseCuthillMcKee) const {
+        BasicReordering<T, Index> result;
+        result.rowOrder = ordering == Ordering::ReverseCuthillMcKee ? reverseCuthillMcKee() : degreeOrder();
+        result.colOrder = result.rowOrder;
+        result.matrix = permuted(result.rowOrder);
+        result.bandwidthBefore = bandwidth();
+        result.bandwidthAfter = result.matrix.bandwidth();
+        result.profileBefore = profile();
+        result.profileAfter = result.matrix.profile();
+        return result;
+    }
+    
+    
+     /*
+     Transposes values of two SparseMatrixs. Where B.tr() is called B[i][j] = A[j][i].
+     The transpose is lazy, so (a*b).tr() and a*b.tr() can be evaluated without an extra temporary. Once
+     evaluated the columns of self are gathered with a counting sort (see compressColumns), which takes time
+     linear in the number of Elements. The transpose of a frozen matrix is frozen; otherwise its rows are
+     rebuilt as ElementLists in row order, so each row's Elements are allocated next to each other.
+     Post: returns the expression for the transpose of self.
+     */
+    MatrixTranspose<BasicSparseMatrix> tr() const {
+        return MatrixTranspose<BasicSparseMatrix>(*this);
+    }
+    
+    
+    /*
+    Adds alpha times rhs into the matrix in place. Each row is merged with the matching row of rhs in one
+    pass which links new Elements in where they belong. A frozen matrix stays frozen: its arrays are
+    rebuilt by merging each row with rhs's.
+    Pre:  rhs has the same number of rows and columns as self.
+    Post: returns the matrix, holding self + alpha*rhs
+    */
+    BasicSparseMatrix & axpy(T alpha, const BasicSparseMatrix &rhs){
+        if(compressed){
+            csr = move(mergedWith(rhs, 1, alpha).csr); //Keeps the matrix's own pool
+            return *this;
+        }
+        for(Index row=0; row < numRows; row++){
+            Element **link = &rows[row].getList();
+            rhs.forEachInRow(row, [&](Index col, T value){ link = rows[row].mergeAt(link, col, alpha * value); });
+        }
+        return *this;
+    }
+    
+/* ---Operators--- */
+    
+    /*
+    Sets the current SparseMatrix to have equal values to the rhs SparseMatrix
+    Post: returns a SpraseMatrix which has equal values to the rhs
+    */
+    BasicSparseMatrix & operator = (const BasicSparseMatrix &rhs){
+        if(this == &rhs)
+            return *this;
+        SPARSEMATRIX_TIME(Assign);
+        deleteRows(); //erase rows from memory
+        
+        numRows = rhs.numRows;
+        numCols = rhs.numCols;
+        compressed = rhs.compressed;
+        csr = rhs.csr;
+        if(!pool)
+            pool = newPoolFor(rhs.pool);
+        
+        if(!compressed){
+            newRows(); //create new list with new size
+            for(Index i=0; i < rhs.numRows; i++){
+                rows[i] = rhs.rows[i];
+            }
+        }
+        
+        return *this;
+    }
+    
+    
+    /*
+    Moves rhs into the current SparseMatrix without copying any Elements, so assigning the result of
+    a*b or a.tr() costs nothing beyond computing it.
+    Post: the current SparseMatrix holds what rhs held, and rhs is left an empty 0x0 matrix
+    */
+    BasicSparseMatrix & operator = (BasicSparseMatrix &&rhs){
+        if(this == &rhs)
+            return *this;
+        deleteRows();
+        
+        numRows = rhs.numRows;
+        numCols = rhs.numCols;
+        compressed = rhs.compressed;
+        csr = move(rhs.csr);
+        pool = move(rhs.pool);
+        rows = rhs.rows;
+        rhs.numRows = 0;
+        rhs.numCols = 0;
+        rhs.compressed = false;
+        rhs.rows = nullptr;
+        return *this;
+    }
+    
+    
+    /*
+    Post: adds rhs into, or subtracts it from, the matrix in place (see axpy) and returns the matrix
+    */
+    BasicSparseMatrix & operator += (const BasicSparseMatrix &rhs){
+        SPARSEMATRIX_TIME(Add);
+        return axpy(1, rhs);
+    }
+    
+    BasicSparseMatrix & operator -= (const BasicSparseMatrix &rhs){
+        SPARSEMATRIX_TIME(Add);
+        return axpy(-1, rhs);
+    }
+    
+    
+    /*
+    Adds or subtracts the value of an expression. A product is accumulated together with the matrix's own
+    rows, so c += a*b never builds a*b on its own. The matrix stays frozen, or not, as it was.
+    Post: returns the matrix, holding self + expression or self - expression
+    */
+    template <class Derived>
+    BasicSparseMatrix & operator += (const MatrixExpression<Derived, BasicSparseMatrix> &expression){
+        return assignKeepingFormat(evaluate(MatrixSum<BasicSparseMatrix, Derived>(*this, static_cast<const Derived &>(expression), 1, 1)));
+    }
+    
+    template <class Derived>
+    BasicSparseMatrix & operator -= (const MatrixExpression<Derived, BasicSparseMatrix> &expression){
+        return assignKeepingFormat(evaluate(MatrixSum<BasicSparseMatrix, Derived>(*this, static_cast<const Derived &>(expression), 1, -1)));
+    }
+    
+    
+    /*
+    Post: every stored value has been multiplied by alpha; returns the matrix
+    */
+    BasicSparseMatrix & operator *= (T alpha){
+        if(compressed){
+            if(csr.values.isView()) //Copy the values out of a mapped file before writing them
+                csr.values.resize(csr.size());
+            for(size_t i=0; i < csr.size(); i++){
+                csr.values[i] *= alpha;
+            }
+            return *this;
+        }
+        for(Index row=0; row < numRows; row++){
+            const ElementList &list = rows[row]; //Only values change, so the row keeps its index
+            for(Element *ptr = list.getList(); ptr != nullptr; ptr = ptr->next){
+                ptr->value *= alpha;
+            }
+        }
+        return *this;
+    }
+    
+    
+    /*
+    Sparse matrix-vector multiply: y = alpha*self*x + beta*y.
+    Rows are split into blocks holding about the same number of Elements and the blocks are shared
+    out over the WorkerPool. When beta is zero y is only written, never read.
+    Pre:  x holds numCols values and y holds numRows values, and the two do not overlap.
+    Post: y holds the result.
+    */
+    void spmv(T *y, const T *x, T alpha=1, T beta=0) const {
+        WorkerPool &pool = WorkerPool::shared();
+        int numBlocks = nonZeros() < parallelThreshold ? 1 : (int)pool.size() * 4;
+        vector<Index> blocks = partitionRows(numBlocks);
+        
+        pool.run(numBlocks, [&](int block){
+            for(Index row = blocks[block]; row < blocks[block+1]; row++){
+                T sum = 0;
+                if(compressed)
+                    sum = csrRowDot(row, x);
+                else
+                    forEachInRow(row, [&](Index col, T value){ sum += value * x[col]; });
+                y[row] = alpha * sum + (beta == 0 ? T(0) : beta * y[row]);
+            }
+        });
+    }
+    
+    
+    /*
+    Sparse times dense matrix multiply: Y = alpha*self*X + beta*Y, where X has k columns, as in block Krylov
+    methods or propagating embeddings. Both dense matrices are row-major: X is numCols x k with X[i][j] at
+    x[i*k + j], and Y is numRows x k.
+    Rows are split over the WorkerPool like spmv, and each block walks its rows in chunks of a few thousand
+    Elements. A chunk is multiplied by one panel of 32 columns of X at a time (then 8, then single columns
+    for what is left), with the panel's sums in vector registers, so an Element is read once per panel and
+    not once per column, and the chunk stays in cache from one panel to the next. When beta is zero y is
+    only written, never read.
+    Pre:  x holds numCols*k values and y holds numRows*k values, and the two do not overlap.
+    Post: y holds the result.
+    */
+    void spmm(T *y, const T *x, Index k, T alpha=1, T beta=0) const {
+        WorkerPool &pool = WorkerPool::shared();
+        int numBlocks = nonZeros() * (size_t)k < parallelThreshold ? 1 : (int)pool.size() * 4;
+        vector<Index> blocks = partitionRows(numBlocks);
+        
+        pool.run(numBlocks, [&](int block){
+            vector<Index> cols;      //A thawed chunk's rows, copied out of their lists
+            vector<T> values;
+            vector<size_t> offsets;
+            for(Index first = blocks[block], last; first < blocks[block+1]; first = last){
+                if(compressed){
+                    for(last = first + 1; last < blocks[block+1] && csr.offsets[last] - csr.offsets[first] < spmmChunkSize; last++);
+                    spmmChunk(csr.indices.data(), csr.values.data(), csr.offsets.data() + first, last - first,
+                              x, y + (size_t)first * k, k, alpha, beta);
+                    continue;
+                }
+                cols.clear();
+                values.clear();
+                offsets.assign(1, 0);
+                for(last = first; last < blocks[block+1] && (last == first || cols.size() < spmmChunkSize); last++){
+                    forEachInRow(last, [&](Index col, T value){
+                        cols.push_back(col);
+                        values.push_back(value);
+                    });
+                    offsets.push_back(cols.size());
+                }
+                spmmChunk(cols.data(), values.data(), offsets.data(), last - first, x, y + (size_t)first * k, k, alpha, beta);
+            }
+        });
+    }
+    
+    
+    /*
+    Computes self*rhs in a semiring other than ordinary arithmetic, such as MinPlus<T> for shortest paths,
+    OrAnd<T> for reachability or MaxTimes<T> for most likely paths (see Semiring). It runs the same
+    parallel, work stealing kernel as a*b, compiled for the semiring.
+    Pre:  rhs numRows must be the exact same as self numCols.
+    Post: returns the product, without Elements equal to Semiring::zero(), frozen if self is frozen.
+    */
+    template <class Semiring>
+    BasicSparseMatrix multiplyOver(const BasicSparseMatrix &rhs) const {
+        BasicSparseMatrix newMatrix = multiplyIn<Semiring>(rhs, Semiring::one(), nullptr, Semiring::one());
+        if(!compressed)
+            newMatrix.thaw();
+        return newMatrix;
+    }
+    
+    
+    /*
+    Computes self*rhs only at the positions mask lets through (see MaskMode), for products such as A*A masked
+    by A in triangle counting, where the full product would be far denser than the part that is needed.
+    Every row picks the cheaper of two kernels. The dot product kernel merges the row of self with each
+    kept column of rhs, costing the row's length plus the column's for every position of the mask. The
+    masked accumulator kernel scales the rows of rhs like multiply() does but only accumulates kept columns,
+    costing as much as that row of the full product. The complement modes always use the accumulator.
+    Rows are shared over the WorkerPool in parts of about equal cost. Memory used is the output, the
+    columns of rhs when any row takes dot products, and one accumulator as long as a row per part.
+    The product can be taken in another Semiring, such as OrAnd<T>, whose dot products stop at the
+    annihilator.
+    Pre:  rhs numRows must be the exact same as self numCols, and mask must be numRows x rhs numCols.
+    Post: returns the masked product, without Elements equal to Semiring::zero(), frozen if self is frozen.
+    */
+    template <class Semiring = PlusTimes<T> >
+    BasicSparseMatrix maskedProduct(const BasicSparseMatrix &rhs, const BasicSparseMatrix &mask, MaskMode mode=MaskMode::Values) const {
+        SPARSEMATRIX_TIME(Multiply);
+        bool complement = mode == MaskMode::ComplementValues || mode == MaskMode::ComplementStructure;
+        bool byValue = mode == MaskMode::Values || mode == MaskMode::ComplementValues;
+        Index p = rhs.numCols;
+        vector<size_t> rhsLength(rhs.numRows, 0), rhsColLength(p, 0);
+        for(Index k=0; k < rhs.numRows; k++){
+            rhs.forEachInRow(k, [&](Index col, T){
+                rhsLength[k]++;
+                rhsColLength[col]++;
+            });
+        }
+        
+        //Cost of each row under both kernels, keeping the cheaper
+        vector<size_t> cost(numRows + 1, 0);
+        vector<char> byDot(numRows, 0);
+        for(Index row=0; row < numRows; row++){
+            size_t length = 0, accumulated = 1;
+            forEachInRow(row, [&](Index k, T){
+                length++;
+                accumulated += rhsLength[k];
+            });
+            size_t dot = 1;
+            mask.forEachInRow(row, [&](Index col, T value){
+                if(!byValue || value != 0)
+                    dot += length + rhsColLength[col];
+                accumulated++;
+            });
+            byDot[row] = !complement && dot < accumulated;
+            cost[row+1] = cost[row] + (byDot[row] ? dot : accumulated);
+        }
+        CompressedStorage columns;
+        if(find(byDot.begin(), byDot.end(), 1) != byDot.end())
+            columns = rhs.compressColumns();
+        
+        WorkerPool &workers = WorkerPool::shared();
+        int numParts = cost[numRows] < parallelThreshold ? 1 : (int)workers.size() * 4;
+        vector<Index> parts = partitionByPrefix(cost.data(), numRows, numParts);
+        vector<vector<Index> > partCols(numParts);
+        vector<vector<T> > partValues(numParts);
+        vector<size_t> rowLength(numRows, 0);
+        workers.run(numParts, [&](int part){
+            vector<Index> &outCols = partCols[part];
+            vector<T> &outValues = partValues[part];
+            vector<T> accumulator;
+            vector<size_t> state; //Per column, 2*row+1 once the mask has marked it in row and 2*row+2 once a product hit it
+            vector<Index> touched;
+            for(Index row = parts[part]; row < parts[part+1]; row++){
+                size_t before = outCols.size();
+                if(byDot[row]){
+                    mask.forEachInRow(row, [&](Index col, T value){
+                        if(byValue && value == 0)
+                            return;
+                        size_t pos = columns.offsets[col], end = columns.offsets[col+1];
+                        T sum = Semiring::zero();
+                        bool found = false;
+                        forEachInRow(row, [&](Index k, T lhsVal){
+                            if(Semiring::hasAnnihilator && sum == Semiring::annihilator())
+                                return; //Nothing can change the sum, so the rest of the column is not read
+                            for(; pos < end && columns.indices[pos] < k; pos++);
+                            if(pos < end && columns.indices[pos] == k){
+                                sum = Semiring::add(sum, Semiring::multiply(lhsVal, columns.values[pos]));
+                                found = true;
+                            }
+                        });
+                        if(found && sum != Semiring::zero()){
+                            outCols.push_back(col);
+                            outValues.push_back(sum);
+                        }
+                    });
+                }
+                else{
+                    if(state.empty()){
+                        accumulator.resize(p);
+                        state.assign(p, 0);
+                    }
+                    size_t marked = 2 * (size_t)row + 1, hit = marked + 1;
+                    mask.forEachInRow(row, [&](Index col, T value){ //With a complement, the marked columns are left out
+                        if(!byValue || value != 0)
+                            state[col] = marked;
+                    });
+                    touched.clear();
+                    forEachInRow(row, [&](Index k, T lhsVal){
+                        rhs.forEachInRow(k, [&](Index col, T rhsVal){
+                            size_t current = state[col];
+                            if(current == hit){
+                                if(!Semiring::hasAnnihilator || accumulator[col] != Semiring::annihilator())
+                                    accumulator[col] = Semiring::add(accumulator[col], Semiring::multiply(lhsVal, rhsVal));
+                            }
+                            else if((current == marked) != complement){
+                                state[col] = hit;
+                                accumulator[col] = Semiring::multiply(lhsVal, rhsVal);
+                                if(complement)
+                                    touched.push_back(col);
+                            }
+                        });
+                    });
+                    if(complement)
+                        sort(touched.begin(), touched.end());
+                    else{ //The mask's row lists the kept columns in order
+                        mask.forEachInRow(row, [&](Index col, T){
+                            if(state[col] == hit)
+                                touched.push_back(col);
+                        });
+                    }
+                    for(size_t i=0; i < touched.size(); i++){
+                        if(accumulator[touched[i]] != Semiring::zero()){
+                            outCols.push_back(touched[i]);
+                            outValues.push_back(accumulator[touched[i]]);
+                        }
+                    }
+                }
+                rowLength[row] = outCols.size() - before;
+            }
+        });
+        
+        CompressedStorage storage;
+        storage.offsets.assign(numRows + 1, 0);
+        for(Index row=0; row < numRows; row++){
+            storage.offsets[row+1] = storage.offsets[row] + rowLength[row];
+        }
+        vector<Index> cols;
+        vector<T> values;
+        cols.reserve(storage.offsets[numRows]);
+        values.reserve(storage.offsets[numRows]);
+        for(int part=0; part < numParts; part++){ //Parts hold consecutive rows, so joining them in order gives the arrays
+            cols.insert(cols.end(), partCols[part].begin(), partCols[part].end());
+            values.insert(values.end(), partValues[part].begin(), partValues[part].end());
+        }
+        storage.indices.assign(move(cols));
+        storage.values.assign(move(values));
+        
+        BasicSparseMatrix newMatrix(numRows, p, move(storage), this->pool);
+        if(!compressed)
+            newMatrix.thaw();
+        return newMatrix;
+    }
+    
+    
+    /*
+    Reads a Matrix Market coordinate file (real, integer or pattern; general, symmetric or skew-symmetric)
+    into the matrix. The file is memory mapped and cut into chunks at line breaks which are parsed on the
+    WorkerPool, then the entries are handed to fromTriplets, merging repeated positions using policy.
+    Post: returns true and replaces the matrix with the file's contents, frozen, if the file could be read
+          and holds exactly as many entries as its size line declares.
+          Returns false and leaves the matrix unchanged otherwise.
+    */
+    bool readMatrixMarket(const string &path, DuplicatePolicy policy=DuplicatePolicy::Sum){
+        MappedFile file(path);
+        if(!file.isOpen())
+            return false;
+        file.adviseSequential();
+        const char *pos = file.data();
+        const char *end = pos + file.size();
+        
+        //Banner: %%MatrixMarket matrix coordinate <field> <symmetry>
+        string banner(pos, find(pos, end, '\n'));
+        for(size_t i=0; i < banner.size(); i++){
+            banner[i] = (char)tolower(banner[i]);
+        }
+        if(banner.compare(0, 14, "%%matrixmarket") != 0 || banner.find("matrix") == string::npos ||
+           banner.find("coordinate") == string::npos || banner.find("complex") != string::npos ||
+           banner.find("hermitian") != string::npos)
+            return false;
+        bool pattern = banner.find("pattern") != string::npos;
+        bool skew = banner.find("skew-symmetric") != string::npos;
+        bool symmetric = skew || banner.find("symmetric") != string::npos;
+        
+        //Skip the comment lines, then read the size line
+        while(pos < end && (*pos == '%' || *pos == '\n' || *pos == '\r')){
+            pos = find(pos, end, '\n');
+            pos += pos < end;
+        }
+        long long n = 0, m = 0, count = 0;
+        pos = parseInteger(pos, end, n);
+        pos = parseInteger(pos, end, m);
+        pos = parseInteger(pos, end, count);
+        if(pos == nullptr || count < 0 || !fitsIndex(n) || !fitsIndex(m))
+            return false;
+        
+        //Cut the entries into chunks which start at a line break and parse them in parallel
+        WorkerPool &pool = WorkerPool::shared();
+        int numChunks = (size_t)(end - pos) < (1 << 20) ? 1 : (int)pool.size() * 8;
+        vector<const char *> starts(numChunks + 1, end);
+        starts[0] = pos;
+        for(int chunk=1; chunk < numChunks; chunk++){
+            const char *cut = max(starts[chunk-1], pos + (end - pos) / numChunks * chunk);
+            cut = find(cut, end, '\n');
+            starts[chunk] = cut + (cut < end);
+        }
+        
+        vector<vector<Triplet> > parsed(numChunks);
+        atomic<bool> failed(false);
+        atomic<long long> lines(0); //Entry lines read, before symmetric files add their mirrored entries
+        pool.run(numChunks, [&](int chunk){
+            vector<Triplet> &entries = parsed[chunk];
+            long long chunkLines = 0;
+            const char *ptr = starts[chunk];
+            const char *chunkEnd = starts[chunk+1];
+            while(ptr != nullptr && ptr < chunkEnd){
+                ptr = skipBlank(ptr, chunkEnd);
+                if(ptr == chunkEnd)
+                    break;
+                if(*ptr == '%'){ //Stray comment line
+                    ptr = find(ptr, chunkEnd, '\n');
+                    continue;
+                }
+                
+                long long row = 0, col = 0;
+                double value = 1;
+                ptr = parseInteger(ptr, chunkEnd, row);
+                ptr = parseInteger(ptr, chunkEnd, col);
+                if(!pattern)
+                    ptr = parseReal(ptr, chunkEnd, value);
+                if(ptr == nullptr || row < 1 || row > n || col < 1 || col > m){
+                    failed = true;
+                    return;
+                }
+                
+                chunkLines++;
+                entries.push_back(Triplet((Index)(row - 1), (Index)(col - 1), (T)value));
+                if(symmetric && row != col)
+                    entries.push_back(Triplet((Index)(col - 1), (Index)(row - 1), (T)(skew ? -value : value)));
+                
+                ptr = find(ptr, chunkEnd, '\n'); //Ignore anything else on the line
+            }
+            lines += chunkLines;
+        });
+        if(failed || lines != count) //A truncated file, or entries past the declared count
+            return false;
+        
+        //Lay the chunks out one after another, in file order, as the arrays fromTriplets reads
+        vector<size_t> chunkStarts(numChunks + 1, 0);
+        for(int chunk=0; chunk < numChunks; chunk++){
+            chunkStarts[chunk+1] = chunkStarts[chunk] + parsed[chunk].size();
+        }
+        size_t total = chunkStarts[numChunks];
+        vector<Index> rowIdx(total);
+        vector<Index> colIdx(total);
+        vector<T> values(total);
+        pool.run(numChunks, [&](int chunk){
+            for(size_t i=0; i < parsed[chunk].size(); i++){
+                rowIdx[chunkStarts[chunk] + i] = parsed[chunk][i].row;
+                colIdx[chunkStarts[chunk] + i] = parsed[chunk][i].col;
+                values[chunkStarts[chunk] + i] = parsed[chunk][i].value;
+            }
+            vector<Triplet>().swap(parsed[chunk]);
+        });
+        
+        shared_ptr<ElementPool> kept = this->pool; //The matrix keeps allocating from its own pool once thawed
+        *this = fromTriplets((Index)n, (Index)m, rowIdx.data(), colIdx.data(), values.data(), total, policy);
+        this->pool = move(kept);
+        return true;
+    }
+    
+    
+    /*
+    Writes the matrix as a Matrix Market general coordinate file, listing only stored Elements. The field is
+    integer, with every digit of each value, for integral value types and real otherwise.
+    The rows are cut into blocks of a few hundred thousand Elements. Each wave of blocks is formatted
+    into one buffer per block on the WorkerPool, and the buffers are then written out in order.
+    Post: returns true if the whole file was written.
+    */
+    bool writeMatrixMarket(const string &path) const {
+        FILE *file = fopen(path.c_str(), "wb");
+        if(file == nullptr)
+            return false;
+        
+        size_t nnz = nonZeros();
+        bool ok = fprintf(file, "%%%%MatrixMarket matrix coordinate %s general\n%lld %lld %zu\n",
+                          is_integral<T>::value ? "integer" : "real", (long long)numRows, (long long)numCols, nnz) > 0;
+        
+        WorkerPool &pool = WorkerPool::shared();
+        int numBlocks = (int)max((size_t)1, nnz / (1 << 18));
+        vector<Index> blocks = partitionRows(numBlocks);
+        int waveSize = (int)pool.size() * 2;
+        vector<vector<char> > buffers(waveSize);
+        
+        for(int wave=0; wave < numBlocks && ok; wave += waveSize){
+            int count = min(waveSize, numBlocks - wave);
+            pool.run(count, [&](int i){
+                vector<char> &buffer = buffers[i];
+                buffer.clear();
+                char line[64];
+                for(Index row = blocks[wave + i]; row < blocks[wave + i + 1]; row++){
+                    forEachInRow(row, [&](Index col, T value){
+                        int length = is_integral<T>::value
+                            ? snprintf(line, sizeof(line), "%lld %lld %lld\n", (long long)row + 1, (long long)col + 1, (long long)value)
+                            : snprintf(line, sizeof(line), "%lld %lld %.*g\n", (long long)row + 1, (long long)col + 1,
+                                       numeric_limits<T>::max_digits10, (double)value);
+                        buffer.insert(buffer.end(), line, line + length);
+                    });
+                }
+            });
+            for(int i=0; i < count && ok; i++){
+                ok = fwrite(buffers[i].data(), 1, buffers[i].size(), file) == buffers[i].size();
+            }
+        }
+        return fclose(file) == 0 && ok;
+    }
+    
+    
+    /*
+    Saves the matrix in the library's binary format: a 64 byte header holding the dimensions, the number
+    of Elements, the value type and the sizes of the stored types, followed by the row offsets, column
+    indices and values arrays, each starting on a 64 byte boundary. Numbers are stored in the machine's
+    own byte order.
+    Post: returns true if the whole file was written.
+    */
+    bool writeBinary(const string &path) const {
+        FILE *file = fopen(path.c_str(), "wb");
+        if(file == nullptr)
+            return false;
+        
+        static_assert(sizeof(BinaryHeader) == 64, "BinaryHeader must fill the first 64 bytes");
+        BinaryHeader header = binaryHeader(numRows, numCols, nonZeros());
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        size_t written = sizeof(header);
+        
+        //A frozen matrix already holds the three arrays, otherwise they are gathered from the rows
+        if(compressed){
+            ok = ok && fwrite(csr.offsets.data(), sizeof(size_t), numRows + 1, file) == (size_t)numRows + 1;
+            written += (numRows + 1) * sizeof(size_t);
+            ok = ok && writePadding(file, written, header.indicesStart);
+            ok = ok && fwrite(csr.indices.data(), sizeof(Index), csr.size(), file) == csr.size();
+            written += csr.size() * sizeof(Index);
+            ok = ok && writePadding(file, written, header.valuesStart);
+            ok = ok && fwrite(csr.values.data(), sizeof(T), csr.size(), file) == csr.size();
+            return fclose(file) == 0 && ok;
+        }
+        
+        vector<size_t> offsets(1, 0);
+        for(Index row=0; row < numRows; row++){
+            size_t length = 0;
+            forEachInRow(row, [&](Index, T){ length++; });
+            offsets.push_back(offsets.back() + length);
+        }
+        ok = ok && fwrite(offsets.data(), sizeof(size_t), offsets.size(), file) == offsets.size();
+        written += offsets.size() * sizeof(size_t);
+        
+        ok = ok && writePadding(file, written, header.indicesStart);
+        vector<Index> cols;
+        for(Index row=0; row < numRows && ok; row++){
+            forEachInRow(row, [&](Index col, T){ cols.push_back(col); });
+            if(cols.size() >= (1 << 16) || row + 1 == numRows){
+                ok = fwrite(cols.data(), sizeof(Index), cols.size(), file) == cols.size();
+                cols.clear();
+            }
+        }
+        written += header.nonZeros * sizeof(Index);
+        
+        ok = ok && writePadding(file, written, header.valuesStart);
+        vector<T> values;
+        for(Index row=0; row < numRows && ok; row++){
+            forEachInRow(row, [&](Index, T value){ values.push_back(value); });
+            if(values.size() >= (1 << 16) || row + 1 == numRows){
+                ok = fwrite(values.data(), sizeof(T), values.size(), file) == values.size();
+                values.clear();
+            }
+        }
+        return fclose(file) == 0 && ok;
+    }
+    
+    
+    /*
+    Opens a file saved by writeBinary without reading or copying it: the file is memory mapped and the
+    matrix's compressed arrays point straight into the mapping. Pages are loaded on first touch and are
+    shared with every other process mapping the same file. The matrix is read-only in this state; thaw()
+    (or writing a value through operator[]) copies it into ElementLists first.
+    Post: returns true and makes the matrix a frozen view of the file if its header is valid for this machine.
+          Returns false and leaves the matrix unchanged otherwise.
+    */
+    bool mapBinary(const string &path){
+        shared_ptr<MappedFile> file = make_shared<MappedFile>(path);
+        if(!file->isOpen() || file->size() < sizeof(BinaryHeader))
+            return false;
+        
+        BinaryHeader header;
+        memcpy(&header, file->data(), sizeof(header));
+        BinaryHeader expected = binaryHeader(header.numRows, header.numCols, header.nonZeros);
+        if(memcmp(&header, &expected, sizeof(header)) != 0 || !fitsIndex(header.numRows) || !fitsIndex(header.numCols) ||
+           file->size() < expected.valuesStart + header.nonZeros * sizeof(T))
+            return false;
+        const size_t *offsets = reinterpret_cast<const size_t *>(file->data() + sizeof(header));
+        if(offsets[0] != 0 || offsets[header.numRows] != header.nonZeros)
+            return false;
+        
+        deleteRows();
+        csr.clear();
+        numRows = (Index)header.numRows;
+        numCols = (Index)header.numCols;
+        compressed = true;
+        csr.offsets.view(offsets, header.numRows + 1);
+        csr.indices.view(reinterpret_cast<const Index *>(file->data() + header.indicesStart), header.nonZeros);
+        csr.values.view(reinterpret_cast<const T *>(file->data() + header.valuesStart), header.nonZeros);
+        csr.mapping = file;
+        return true;
+    }
+    
+    
+    /*
+    Returns a value when SparseMatrix[row] is accessed.
+    Pre:  row must be within the SparseMatrix's range
+    Post: returns a read-only view of the row row, which copies nothing whether or not the matrix is frozen
+    */
+    RowView operator [] (Index row) const {
+        return rowView(row);
+    }
+
+    
+    /*
+    Returns a value when SparseMatrix[row] is accessed. Called when an ElementList at an index is set.
+    Pre:  row must be within the SparseMatrix's range
+    Post: returns a reference to the row row. Reads through it leave a frozen matrix frozen; writing a value
+          or assigning the row thaws the matrix first.
+    */
+    RowReference operator [] (Index row){
+        return RowReference(this, row);
+    }
+    
+    
+/*---Unit Tests---*/
+    /*
+    Unit test for multiplying two sparsematrices. Checks if after multiplying the resulting
      sparsematrix's rows and cols are correctly sized and that all resulting values in the
      new sparsematrix are correct.
     Post: returns true if the unit test passes, or false if it fails
     */
-    bool sparseMatrixMultUnitTest(){
-        SparseMatrix a(3,5);
-        SparseMatrix b(5,3);
-        
-        a[0][1] = 1;
-        a[0][4] = 5;
-        a[1][2] = 2;
-        a[2][2] = 3;
-        
-        b[0][0] = 1;
-        b[1][1] = 6;
-        b[2][2] = 2;
-        b[3][0] = 0;
-        b[3][2] = 3;
-        
-        SparseMatrix c = a*b;
-        if(c.numRows==3 && c.numCols==3){ //Unit test - first check if the correct size is set
-            if(c[0][1]==6 && c[1][2]==4 && c[2][2]==6){ //check if values are correct
-                return true;
+    bool sparseMatrixMultUnitTest(){
+        SparseMatrix a(3,5);
+        SparseMatrix b(5,3);
+        
+        a[0][1] = 1;
+        a[0][4] = 5;
+        a[1][2] = 2;
+        a[2][2] = 3;
+        
+        b[0][0] = 1;
+        b[1][1] = 6;
+        b[2][2] = 2;
+        b[3][0] = 0;
+        b[3][2] = 3;
+        
+        SparseMatrix c = a*b;
+        if(c.numRows==3 && c.numCols==3){ //Unit test - first check if the correct size is set
+            if(c[0][1]==6 && c[1][2]==4 && c[2][2]==6){ //check if values are correct
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    /*
+    Unit test for multiplying sparsematrices holding fractional values. Checks that products are
+     accumulated as doubles, that columns reached through several rows are summed, and that no
+     Elements are created for positions whose product is zero.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixMultFractionUnitTest(){
+        SparseMatrix a(2,3);
+        SparseMatrix b(3,4);
+        
+        a[0][0] = 0.5;
+        a[0][2] = 1.5;
+        a[1][1] = 0.25;
+        
+        b[0][3] = 3;
+        b[1][0] = 2;
+        b[2][1] = 1;
+        b[2][3] = 1;
+        
+        SparseMatrix c = a*b;
+        
+        int numOfElements=0;
+        for(int row=0; row < c.numRows; row++){
+            for(Element *ptr = c.rows[row].getList(); ptr != nullptr; ptr = ptr->next){
+                numOfElements++;
+            }
+        }
+        if(numOfElements != 3)
+            return false;
+        
+        //c[0][3] = 0.5*3 + 1.5*1
+        if(c[0][1]==1.5 && c[0][3]==3 && c[1][0]==0.5){
+            return true;
+        }
+        return false;
+    }
+    
+    /*
+    Unit test for copying a sparsematrix with the = operator. Checks for sizes being set
+     correctly and that all values are the same after the = operator with no extra elements being added.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixEqualsUnitTest(){
+        SparseMatrix a(2,3);
+        // 0 1 2
+        // 3 4 5
+        a[0][1] = 1;
+        a[0][2] = 2;
+        a[1][0] = 3;
+        a[1][1] = 4;
+        a[1][2] = 5;
+        
+        SparseMatrix b = a;
+        
+        if(b.numRows!=a.numRows || b.numCols!=a.numCols) //Test if sizes are the same
+            return false;
+        
+        
+        for(int row=0; row<a.numRows; row++){//Test if same number of elements exist in both
+            Element *bRowHead = b.rows[row].getList();
+            Element *aRowHead = a.rows[row].getList();
+            
+            int bRowCount=0;
+            int aRowCount=0;
+            
+            while(bRowHead != nullptr){
+                bRowCount++;
+                bRowHead = bRowHead->next;
+            }
+            while(aRowHead != nullptr){
+                aRowCount++;
+                aRowHead = aRowHead->next;
+            }
+            
+            if(aRowCount != bRowCount)
+                return false;
+        }
+        
+        if(b[0][1]==1 && b[0][2]==2 && b[1][0]==3 && b[1][1]==4 && b[1][2]==5){//check if values are correct
+            //If here has been reached the matrix b has only the elements a has and in the correct locations.
+            return true;
+        }
+        
+        return false;
+    }
+    
+    /*
+    Unit test for moving sparsematrices and reading them through a const reference. Checks that a move
+     takes over the Elements and their pool without copying them, that self assignment keeps the matrix intact, and
+     that reading a missing position of a const matrix creates no Element.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixMoveUnitTest(){
+        SparseMatrix a(2,3);
+        a[0][1] = 1;
+        a[1][2] = 2;
+        Element *head = a.rows[0].getList();
+        
+        shared_ptr<ElementPool> pool = a.pool;
+        SparseMatrix b(move(a));
+        if(a.numRows!=0 || a.rows!=nullptr || b.numRows!=2 || b.rows[0].getList()!=head)
+            return false;
+        if(a.pool || b.pool != pool || b.nonZeros()!=2 || b.at(0,1)!=1 || b.at(1,2)!=2)
+            return false;
+        a = SparseMatrix(1,2); //The moved-from matrix is empty and can be used again
+        a[0][1] = 3;
+        if(a.nonZeros()!=1 || a.at(0,1)!=3 || !a.pool || a.pool == pool)
+            return false;
+        
+        SparseMatrix d;
+        d = move(b);
+        if(b.pool || d.pool != pool)
+            return false;
+        b = d; //A moved-from matrix can be assigned to again, and gets a pool of its own
+        if(!b.pool || b.pool == pool || b.at(1,2)!=2)
+            return false;
+        pool.reset();
+        
+        SparseMatrix &self = b;
+        b = self;
+        if(b.nonZeros()!=2 || b.at(0,1)!=1 || b.at(1,2)!=2)
+            return false;
+        
+        const SparseMatrix &constB = b;
+        if(constB[0][0]!=0 || constB[0][1]!=1 || b.nonZeros()!=2) //No Element created at (0,0)
+            return false;
+        
+        SparseMatrix c;
+        c = b.tr(); //Move assigned from the temporary
+        b.freeze();
+        const SparseMatrix &frozenB = b;
+        if(c.numRows==3 && c.at(1,0)==1 && c.at(2,1)==2 && frozenB[1][2]==2 && frozenB[1][1]==0){
+            return true;
+        }
+        return false;
+    }
+    
+    
+    /*
+    Unit test for transposing a sparsematrix. Checks if the transposed sparsematrix has its
+     transposed values in the correct places.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixTransposeUnitTest(){
+        SparseMatrix a(3,5);
+        /*
+        2 x 1 9 x
+        x x x x 4
+        x 7 x x x
+        */
+        
+        a[0][0] = 2;
+        a[0][2] = 1;
+        a[0][3] = 9;
+        a[1][4] = 4;
+        a[2][1] = 7;
+        
+        SparseMatrix b = a.tr();
+        if(b.numRows==a.numCols && b.numCols==a.numRows){//Unit test - first check if the sizes have been flipped
+            int numOfElementsA=0;
+            for(int row=0; row < a.numRows; row++){
+                Element *ptr = a.rows[row].getList(); //point to head of row
+                while(ptr != nullptr){
+                    numOfElementsA++;
+                    ptr = ptr->next;
+                }
+            }
+            
+            int numOfElementsB=0;
+            for(int row=0; row < b.numRows; row++){
+                Element *ptr = b.rows[row].getList();
+                while(ptr != nullptr){
+                    numOfElementsB++;
+                    ptr = ptr->next;
+                }
+            }
+            
+            //Unit test - Ensure matrices have same number of element
+            if(numOfElementsA != numOfElementsB){
+                return false;
+            }
+            
+            //Unit test - Ensure that the matrices share the same values and positions
+            if(b[0][0]==2 && b[1][2]==7 && b[2][0]==1 && b[3][0]==9 && b[4][1]==4){//check if values are in the correct positions for matrix b
+                return true;
+            }
+            
+        }
+        
+        return false;
+    }
+    
+    
+    /*
+    Unit test for transposing a sparsematrix with more rows than columns. Checks that Elements in the
+     rows past the transpose's row count are carried over, in both the linked list and frozen forms.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixTransposeTallUnitTest(){
+        SparseMatrix a(5,2);
+        /*
+        1 x
+        x x
+        x 2
+        3 x
+        x 4
+        */
+        a[0][0] = 1;
+        a[2][1] = 2;
+        a[3][0] = 3;
+        a[4][1] = 4;
+        
+        SparseMatrix b = a.tr();
+        a.freeze();
+        SparseMatrix c = a.tr();
+        if(b.numRows!=2 || b.numCols!=5 || b.isFrozen() || !c.isFrozen() || b.nonZeros()!=4 || c.nonZeros()!=4)
+            return false;
+        
+        for(int row=0; row < 2; row++){
+            for(int col=0; col < 5; col++){
+                if(b.at(row,col) != a.at(col,row) || c.at(row,col) != a.at(col,row))
+                    return false;
+            }
+        }
+        return true;
+    }
+    
+    
+    /*
+    Unit test for freezing and thawing a sparsematrix. Checks that a frozen matrix reads, transposes
+     and multiplies to the same values as before, that its results stay frozen, that reading it through
+     [] leaves it frozen, and that writing a value thaws it with every Element intact.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixFreezeUnitTest(){
+        SparseMatrix a(3,5);
+        /*
+        2 x 1 9 x
+        x x x x 4
+        x 7 x x x
+        */
+        a[0][0] = 2;
+        a[0][2] = 1;
+        a[0][3] = 9;
+        a[1][4] = 4;
+        a[2][1] = 7;
+        
+        a.freeze();
+        if(!a.isFrozen() || a.nonZeros() != 5)
+            return false;
+        if(a.at(0,3)!=9 || a.at(1,4)!=4 || a.at(2,1)!=7 || a.at(1,0)!=0)
+            return false;
+        
+        SparseMatrix b = a.tr();
+        if(!b.isFrozen() || b.numRows!=5 || b.numCols!=3)
+            return false;
+        if(b.at(0,0)!=2 || b.at(2,0)!=1 || b.at(3,0)!=9 || b.at(4,1)!=4 || b.at(1,2)!=7)
+            return false;
+        
+        SparseMatrix c = a*b; //a * a.tr() is 3x3 with row dot products
+        if(!c.isFrozen() || c.nonZeros() != 3)
+            return false;
+        if(c.at(0,0)!=86 || c.at(1,1)!=16 || c.at(2,2)!=49)
+            return false;
+        
+        double read = a[0][3] + a[1][0] + a[2].getIth(1); //Reads through a non-const matrix leave it frozen
+        RowView view = a[1];
+        if(read != 16 || view[4] != 4 || !a.isFrozen() || a.nonZeros() != 5)
+            return false;
+        
+        a[1][0] = 5; //Editing thaws the matrix into linked list rows
+        if(a.isFrozen() || a.nonZeros() != 6)
+            return false;
+        if(a[0][0]==2 && a[0][2]==1 && a[0][3]==9 && a[1][0]==5 && a[1][4]==4 && a[2][1]==7){
+            return true;
+        }
+        return false;
+    }
+    
+    
+    /*
+    Unit test for multiplying a sparsematrix by a dense vector. Checks y = alpha*A*x + beta*y on both
+     linked list and frozen rows, and that the row blocks handed to the WorkerPool cover every row once.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixSpmvUnitTest(){
+        SparseMatrix a(3,4);
+        /*
+        1 x 2 x
+        x x x x
+        x 3 x 4
+        */
+        a[0][0] = 1;
+        a[0][2] = 2;
+        a[2][1] = 3;
+        a[2][3] = 4;
+        
+        double x[4] = {1, 2, 3, 4};
+        double y[3] = {1, 1, 1};
+        a.spmv(y, x, 2, 0.5); //y = 2*A*x + 0.5*y
+        if(y[0]!=14.5 || y[1]!=0.5 || y[2]!=44.5)
+            return false;
+        
+        a.freeze();
+        double z[3] = {-1, -1, -1};
+        a.spmv(z, x); //beta of zero ignores what z held
+        if(z[0]!=7 || z[1]!=0 || z[2]!=22)
+            return false;
+        if(!spmvPathsMatch<double>() || !spmvPathsMatch<float>())
+            return false;
+        
+        vector<int> blocks = a.partitionRows(8);
+        if(blocks.size()!=9 || blocks[0]!=0 || blocks[8]!=3)
+            return false;
+        for(int b=0; b < 8; b++){
+            if(blocks[b] > blocks[b+1])
+                return false;
+        }
+        return true;
+    }
+    
+    
+    /*
+    Checks that the vectorized spmv of a frozen matrix matches the list path of the same matrix thawed, on
+    rows of every length from 0 to 79 so each SIMD loop and the scalar tail get used. The values are small
+    integers so both paths are exact.
+    */
+    template <class U>
+    static bool spmvPathsMatch(){
+        const int n = 80, m = 331;
+        BasicSparseMatrix<U, int> listed(n, m);
+        for(int row=0; row < n; row++){
+            for(int k=0; k < row; k++){
+                listed[row][(k * 37 + row * 11) % m] = (U)((k + row) % 7 - 3);
+            }
+        }
+        BasicSparseMatrix<U, int> frozen = listed;
+        frozen.freeze();
+        vector<U> x(m), expected(n), y(n);
+        for(int i=0; i < m; i++){
+            x[i] = (U)(i % 5 - 2);
+        }
+        listed.spmv(expected.data(), x.data());
+        frozen.spmv(y.data(), x.data());
+        return listed.compressed == false && y == expected;
+    }
+    
+    
+    /*
+    Unit test for allocating a sparsematrix's Elements from a plugged in ElementPool. Checks that every
+     Element comes from the given pool, that Elements created one after another are adjacent in memory,
+     that copies and thawed transposes allocate from a new pool of the same kind while frozen results of
+     default pool matrices make none until thawed, and that every Element is handed back to the pool once the matrix and its copied row
+     are destroyed. Also checks that a matrix holding every Element of its pool frees them with the slabs, even while an empty
+     list still shares the pool.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixPoolUnitTest(){
+        struct CountingPool : public ElementPool {
+            int allocated = 0;
+            int released = 0;
+            Element * allocate(int col, double value, Element *next){
+                allocated++;
+                return ElementPool::allocate(col, value, next);
+            }
+            void release(Element *element){
+                released++;
+                ElementPool::release(element);
+            }
+            shared_ptr<ElementPool> newPool() const {
+                return make_shared<CountingPool>();
+            }
+        };
+        shared_ptr<CountingPool> pool = make_shared<CountingPool>();
+        
+        {
+            SparseMatrix a(2, 4, pool);
+            a[0][1] = 1;
+            a[0][3] = 2;
+            a[1][0] = 3;
+            a[0][1] = 4; //Overwrite, no new Element
+            
+            Element *first = a.rows[0].getList();
+            if(pool->allocated != 3 || first->next != first + 1)
+                return false;
+            if(a[0][1]!=4 || a[0][3]!=2 || a[1][0]!=3)
+                return false;
+            
+            ElementList copy = a[0]; //A copied row keeps allocating from the same pool
+            if(pool->allocated != 5 || copy[3] != 2)
+                return false;
+            
+            SparseMatrix b = a; //Copies allocate from a new pool of the same kind
+            CountingPool *copied = dynamic_cast<CountingPool *>(b.pool.get());
+            if(copied == nullptr || copied == pool.get() || copied->allocated != 3 || pool->allocated != 5)
+                return false;
+            
+            a.freeze();
+            SparseMatrix transposed = a.tr(); //Frozen, and thaws into a pool of a's kind
+            transposed.thaw();
+            CountingPool *thawed = dynamic_cast<CountingPool *>(transposed.pool.get());
+            if(thawed == nullptr || thawed->allocated != 3)
+                return false;
+            
+            vector<Triplet> triplets(1, Triplet(0, 0, 1));
+            SparseMatrix built = SparseMatrix::fromTriplets(1, 1, triplets.begin(), triplets.end());
+            SparseMatrix product = built * built;
+            if(built.pool || product.pool) //Frozen matrices of the default pool make none until thawed
+                return false;
+            built.thaw();
+            if(!built.pool || built[0][0] != 1)
+                return false;
+        }
+        if(pool->allocated != 5 || pool->released != 5)
+            return false;
+        
+        shared_ptr<CountingPool> bulk = make_shared<CountingPool>();
+        ElementList empty(4, bulk); //Shares the pool but holds no Element
+        {
+            SparseMatrix a(2, 4, bulk);
+            a[0][1] = 1;
+            a[1][2] = 2;
+        }
+        empty[2] = 5; //The pool still hands out Elements after its slabs were freed
+        return bulk->allocated == 3 && bulk->released == 0 && bulk->elementsInUse() == 1 && empty[2] == 5;
+    }
+    
+    
+    /*
+    Unit test for saving and loading Matrix Market files. Checks that a written matrix reads back with
+     the same Elements, and that a symmetric pattern file is mirrored across the diagonal.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixMatrixMarketUnitTest(){
+        const string path = "SparseMatrixUnitTest.mtx";
+        SparseMatrix a(3,4);
+        a[0][3] = 0.1;
+        a[2][0] = -2.5e-7;
+        a[2][2] = 12345;
+        
+        SparseMatrix b;
+        bool roundTrip = a.writeMatrixMarket(path) && b.readMatrixMarket(path);
+        
+        FILE *file = fopen(path.c_str(), "w");
+        fputs("%%MatrixMarket matrix coordinate pattern symmetric\n% a comment\n3 3 2\n1 1\n3 2\n", file);
+        fclose(file);
+        SparseMatrix c;
+        bool symmetric = c.readMatrixMarket(path);
+        
+        file = fopen(path.c_str(), "w");
+        fputs("%%MatrixMarket matrix coordinate real general\n3 3 5\n1 1 2.5\n", file); //Cut off after one entry
+        fclose(file);
+        SparseMatrix d;
+        bool truncated = d.readMatrixMarket(path);
+        file = fopen(path.c_str(), "w");
+        fputs("%%MatrixMarket matrix coordinate real general\n3 3 1\n1 1 2.5\n2 2 3\n", file); //One entry too many
+        fclose(file);
+        bool overlong = d.readMatrixMarket(path);
+        remove(path.c_str());
+        if(truncated || overlong || d.numRows!=0)
+            return false;
+        
+        if(!roundTrip || b.numRows!=3 || b.numCols!=4 || b.nonZeros()!=3)
+            return false;
+        if(b.at(0,3)!=0.1 || b.at(2,0)!=-2.5e-7 || b.at(2,2)!=12345)
+            return false;
+        if(symmetric && c.nonZeros()==3 && c.at(0,0)==1 && c.at(2,1)==1 && c.at(1,2)==1){
+            return true;
+        }
+        return false;
+    }
+    
+    
+    /*
+    Unit test for building a sparsematrix from unordered triplets. Checks that rows come out sorted by
+     column and that repeated positions are merged by each DuplicatePolicy.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixTripletsUnitTest(){
+        vector<Triplet> triplets;
+        triplets.push_back(Triplet(2, 3, 1));
+        triplets.push_back(Triplet(0, 4, 5));
+        triplets.push_back(Triplet(2, 0, 7));
+        triplets.push_back(Triplet(0, 1, 2));
+        triplets.push_back(Triplet(2, 3, 4)); //Repeats (2,3)
+        triplets.push_back(Triplet(2, 3, 3)); //Repeats (2,3)
+        
+        SparseMatrix sum = SparseMatrix::fromTriplets(3, 5, triplets.begin(), triplets.end());
+        SparseMatrix last = SparseMatrix::fromTriplets(3, 5, triplets.begin(), triplets.end(), DuplicatePolicy::Last);
+        SparseMatrix largest = SparseMatrix::fromTriplets(3, 5, triplets.begin(), triplets.end(), DuplicatePolicy::Max);
+        
+        if(!sum.isFrozen() || sum.nonZeros()!=4 || last.nonZeros()!=4 || largest.nonZeros()!=4)
+            return false;
+        if(sum.at(2,3)!=8 || last.at(2,3)!=3 || largest.at(2,3)!=4)
+            return false;
+        
+        const CompressedStorage &csr = sum.compressedRows();
+        if(csr.indices[0]!=1 || csr.indices[1]!=4 || csr.indices[2]!=0 || csr.indices[3]!=3) //Sorted within each row
+            return false;
+        if(sum.at(0,1)==2 && sum.at(0,4)==5 && sum.at(2,0)==7 && sum.at(1,1)==0){
+            return true;
+        }
+        return false;
+    }
+    
+    
+    /*
+    Unit test for the binary format. Checks that a mapped matrix reads its arrays straight from the
+     file, can be multiplied and transposed, and is copied into memory when it is edited.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixBinaryUnitTest(){
+        const string path = "SparseMatrixUnitTest.bin";
+        SparseMatrix a(3,4);
+        a[0][3] = 0.1;
+        a[2][0] = -2.5;
+        a[2][2] = 7;
+        
+        SparseMatrix b;
+        bool roundTrip = a.writeBinary(path) && b.mapBinary(path);
+        remove(path.c_str()); //The mapping stays valid after the name is removed
+        
+        if(!roundTrip || !b.isFrozen() || !b.compressedRows().values.isView())
+            return false;
+        if(b.numRows!=3 || b.numCols!=4 || b.nonZeros()!=3 || b.at(0,3)!=0.1 || b.at(2,0)!=-2.5)
+            return false;
+        
+        SparseMatrix product = b * b.tr();
+        if(product.at(0,0)!=0.1*0.1 || product.at(2,2)!=2.5*2.5+49)
+            return false;
+        
+        b[1][1] = 4;
+        if(!b.isFrozen() && b.nonZeros()==4 && b.at(1,1)==4 && b.at(2,2)==7 && !b.mapBinary(path)){
+            return true;
+        }
+        return false;
+    }
+    
+    
+    /*
+    Unit test for the parallel multiply. Checks work stealing hands out every item exactly once when all
+     of them start on one thread, and that a product with a few very long rows and columns matches a
+     dense product whether the operands are frozen or not.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixParallelMultUnitTest(){
+        WorkerPool workers(4);
+        vector<atomic<int> > visits(1000);
+        for(size_t i=0; i < visits.size(); i++){
+            visits[i] = 0;
+        }
+        vector<int> bounds(5, 1000);
+        bounds[0] = 0; //Slot 0 starts with every item and the other slots have to steal
+        workers.runStealing(bounds, 3, [&](int begin, int end, int){
+            for(int i = begin; i < end; i++){
+                visits[i]++;
+            }
+        });
+        for(size_t i=0; i < visits.size(); i++){
+            if(visits[i] != 1)
+                return false;
+        }
+        
+        const int n = 300;
+        vector<double> dense(n * n, 0.);
+        SparseMatrix a(n,n);
+        for(int i=0; i < n; i++){ //Row 0 and column 0 are full, plus the diagonal and a scattering of others
+            a[0][i] = dense[i] = i % 5 + 1;
+            a[i][0] = dense[i * n] = i % 3 + 1;
+            a[i][i] = dense[i * n + i] = 2;
+            a[i][(i * 37) % n] = dense[i * n + (i * 37) % n] = -1;
+        }
+        
+        SparseMatrix product = a * a;
+        a.freeze();
+        SparseMatrix frozenProduct = a * a;
+        if(product.isFrozen() || !frozenProduct.isFrozen())
+            return false;
+        for(int i=0; i < n; i++){
+            for(int j=0; j < n; j++){
+                double expected = 0;
+                for(int k=0; k < n; k++){
+                    expected += dense[i * n + k] * dense[k * n + j];
+                }
+                if(product.at(i,j) != expected || frozenProduct.at(i,j) != expected)
+                    return false;
+            }
+        }
+        return true;
+    }
+    
+    
+    /*
+    Unit test for matrices of other value and index types. Checks float and 8 bit integer products, that a
+     64 bit indexed matrix can hold columns past the range of an int, that a binary file only maps
+     into a matrix of the type which wrote it, and that integer values survive a Matrix Market file.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixTypesUnitTest(){
+        BasicSparseMatrix<float, int> a(2,3);
+        a[0][0] = 1.5f;
+        a[1][2] = -2;
+        BasicSparseMatrix<float, int> square = a * a.tr();
+        if(square.at(0,0)!=2.25f || square.at(1,1)!=4 || square.at(0,1)!=0 || sizeof(BasicElement<float, int>) >= sizeof(Element))
+            return false;
+        
+        BasicSparseMatrix<int8_t, int> b(2,2);
+        b[0][1] = 3;
+        b[1][0] = -4;
+        BasicSparseMatrix<int8_t, int> product = b * b;
+        if(product.at(0,0)!=-12 || product.at(1,1)!=-12 || product.nonZeros()!=2)
+            return false;
+        
+        const long long wide = 5000000000LL;
+        vector<BasicTriplet<double, long long> > triplets;
+        triplets.push_back(BasicTriplet<double, long long>(1, wide - 1, 7));
+        triplets.push_back(BasicTriplet<double, long long>(0, 3000000000LL, 2));
+        BasicSparseMatrix<double, long long> c = BasicSparseMatrix<double, long long>::fromTriplets(2, wide, triplets.begin(), triplets.end());
+        if(c.numCols!=wide || c.at(1, wide - 1)!=7 || c.at(0, 3000000000LL)!=2 || c.at(0, 0)!=0)
+            return false;
+        
+        const string path = "SparseMatrixUnitTest.bin";
+        SparseMatrix wrongType;
+        BasicSparseMatrix<float, int> mapped;
+        bool written = a.writeBinary(path);
+        bool rejected = !wrongType.mapBinary(path);
+        bool accepted = mapped.mapBinary(path);
+        remove(path.c_str());
+        if(!written || !rejected || !accepted || mapped.at(1,2)!=-2)
+            return false;
+        
+        const string mtxPath = "SparseMatrixUnitTest.mtx";
+        BasicSparseMatrix<int, int> d(2,3), readBack;
+        d[0][2] = 123;
+        d[1][0] = -4567;
+        d[1][1] = 2000000001;
+        bool integerRoundTrip = d.writeMatrixMarket(mtxPath) && readBack.readMatrixMarket(mtxPath);
+        remove(mtxPath.c_str());
+        if(integerRoundTrip && readBack.nonZeros()==3 && readBack.at(0,2)==123 && readBack.at(1,0)==-4567
+           && readBack.at(1,1)==2000000001){
+            return true;
+        }
+        return false;
+    }
+    
+    
+    /*
+    Unit test for adding rows and matrices. Checks in-place ElementList +=, -= and axpy (including adding
+     a list to itself), and matrix + and += whether either side is frozen.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixAddUnitTest(){
+        ElementList lhs(5);
+        ElementList rhs(5);
+        lhs[0] = 1;
+        lhs[3] = 2;
+        rhs[0] = 2;
+        rhs[1] = 4;
+        rhs[4] = 1;
+        
+        lhs += rhs; //[ 3 4 0 2 1 ]
+        if(lhs[0]!=3 || lhs[1]!=4 || lhs[3]!=2 || lhs[4]!=1)
+            return false;
+        lhs -= rhs; //[ 1 0 0 2 0 ], keeping Elements which cancelled out
+        lhs.axpy(2, lhs); //[ 3 0 0 6 0 ]
+        if(lhs[0]!=3 || lhs[1]!=0 || lhs[3]!=6 || lhs[4]!=0)
+            return false;
+        ElementList difference = lhs - rhs; //[ 1 -4 0 6 -1 ]
+        if(difference[0]!=1 || difference[1]!=-4 || difference[3]!=6 || difference[4]!=-1)
+            return false;
+        
+        SparseMatrix a(2,3);
+        SparseMatrix b(2,3);
+        a[0][0] = 1;
+        a[1][2] = 2;
+        b[0][0] = 5;
+        b[0][1] = 3;
+        b[1][0] = -1;
+        
+        SparseMatrix sum = a + b;
+        a.freeze();
+        SparseMatrix frozenSum = a + b;
+        SparseMatrix frozenDifference = a - b;
+        b += a; //b is not frozen, a is
+        a -= a;
+        if(sum.isFrozen() || !frozenSum.isFrozen() || !a.isFrozen())
+            return false;
+        if(frozenDifference.at(0,0)!=-4 || frozenDifference.at(0,1)!=-3 || frozenDifference.at(1,2)!=2 || a.at(1,2)!=0)
+            return false;
+        for(int row=0; row < 2; row++){
+            for(int col=0; col < 3; col++){
+                if(sum.at(row,col)!=frozenSum.at(row,col) || sum.at(row,col)!=b.at(row,col))
+                    return false;
+            }
+        }
+        return sum.at(0,0)==6 && sum.at(0,1)==3 && sum.at(1,0)==-1 && sum.at(1,2)==2;
+    }
+    
+    
+    /*
+    Unit test for lazy expressions. Checks that fused products, sums, scaling and transposes give the same
+     values as computing every step on its own, and that each result is frozen when it should be.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixExpressionUnitTest(){
+        SparseMatrix a(3,4);
+        SparseMatrix b(4,3);
+        SparseMatrix c(3,3);
+        a[0][0] = 1;
+        a[0][3] = 2;
+        a[1][1] = -1;
+        a[2][2] = 3;
+        b[0][0] = 2;
+        b[1][2] = 4;
+        b[2][1] = 1;
+        b[3][0] = -1;
+        b[3][2] = 5;
+        c[0][0] = 1;
+        c[1][1] = 7;
+        c[2][1] = -3;
+        
+        SparseMatrix product = a*b;
+        SparseMatrix transposed = product.tr(); //Transposes the product itself
+        SparseMatrix fusedSum = a*b + c;
+        SparseMatrix fusedDifference = c - 2*(a*b);
+        SparseMatrix scaledLhs = 2*a*b;
+        SparseMatrix fusedTranspose = (a*b).tr();
+        SparseMatrix doubleTranspose = a.tr().tr();
+        SparseMatrix accumulated = c;
+        accumulated += a*b;
+        
+        if(product.at(0,0)!=0 || product.at(0,2)!=10 || product.at(1,2)!=-4 || product.at(2,1)!=3)
+            return false;
+        for(int row=0; row < 3; row++){
+            for(int col=0; col < 3; col++){
+                double expected = product.at(row,col);
+                if(fusedSum.at(row,col)!=expected + c.at(row,col) || accumulated.at(row,col)!=fusedSum.at(row,col) ||
+                   fusedDifference.at(row,col)!=c.at(row,col) - 2*expected || scaledLhs.at(row,col)!=2*expected ||
+                   fusedTranspose.at(col,row)!=expected || transposed.at(col,row)!=expected)
+                    return false;
+            }
+        }
+        if(product.nonZeros()!=3 || fusedTranspose.nonZeros()!=3) //A[0]*B[0] cancels to zero and is not stored
+            return false;
+        if(product.isFrozen() || fusedSum.isFrozen() || fusedTranspose.isFrozen() || accumulated.isFrozen())
+            return false;
+        for(int row=0; row < 3; row++){
+            for(int col=0; col < 4; col++){
+                if(doubleTranspose.at(row,col)!=a.at(row,col))
+                    return false;
+            }
+        }
+        
+        a.freeze();
+        c.freeze();
+        SparseMatrix frozenTranspose = (a*b).tr();
+        SparseMatrix frozenSum = c + a*b;
+        c += b.tr()*a.tr();
+        if(!frozenTranspose.isFrozen() || !frozenSum.isFrozen() || !c.isFrozen())
+            return false;
+        for(int row=0; row < 3; row++){
+            for(int col=0; col < 3; col++){
+                if(frozenTranspose.at(col,row)!=product.at(row,col) || frozenSum.at(row,col)!=fusedSum.at(row,col) ||
+                   c.at(row,col)!=fusedSum.at(row,col) + product.at(col,row) - product.at(row,col))
+                    return false;
+            }
+        }
+        return true;
+    }
+    
+    
+    /*
+    Unit test for block sparse matrices. Converts a matrix whose size is not a multiple of the block sizes
+     and checks element reads, the conversion back, spmv and products of blocks of several shapes against
+     the same operations on the SparseMatrix, and that detectBlockShape finds 2 x 2 blocks.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixBlockUnitTest(){
+        SparseMatrix a(10,9);
+        for(int row=0; row < 10; row++){
+            for(int col=0; col < 9; col++){
+                if((row / 2 + col / 2) % 3 == 0 || (row * 7 + col) % 11 == 0)
+                    a[row][col] = (row * 9 + col) % 7 - 3;
+            }
+        }
+        SparseMatrix aT = a.tr();
+        BasicBlockSparseMatrix<T, Index, 2, 2> blocks2(a);
+        BasicBlockSparseMatrix<T, Index, 4, 2> blocks42(a);
+        BasicBlockSparseMatrix<T, Index, 8, 8> blocks8(a);
+        BasicBlockSparseMatrix<T, Index, 2, 8> blocksT(aT);
+        if(blocks2.numBlocks() <= blocks8.numBlocks() || blocks2.nonZeros() != a.nonZeros() - 3) //3 Elements of a hold zero
+            return false;
+        
+        SparseMatrix back = blocks8.toSparseMatrix();
+        double x[9], y[10], y2[10], y42[10], y8[10];
+        for(int col=0; col < 9; col++){
+            x[col] = col - 4;
+        }
+        for(int row=0; row < 10; row++){
+            y[row] = y2[row] = y42[row] = y8[row] = row;
+        }
+        a.spmv(y, x, 2, 1);
+        blocks2.spmv(y2, x, 2, 1);
+        blocks42.spmv(y42, x, 2, 1);
+        blocks8.spmv(y8, x, 2, 1);
+        for(int row=0; row < 10; row++){
+            if(y2[row] != y[row] || y42[row] != y[row] || y8[row] != y[row])
+                return false;
+            for(int col=0; col < 9; col++){
+                if(blocks2.at(row,col) != a.at(row,col) || blocks8.at(row,col) != a.at(row,col) || back.at(row,col) != a.at(row,col))
+                    return false;
+            }
+        }
+        
+        SparseMatrix product = a * aT;
+        SparseMatrix product2 = (blocks2 * BasicBlockSparseMatrix<T, Index, 2, 2>(aT)).toSparseMatrix();
+        SparseMatrix product48 = (blocks42 * blocksT).toSparseMatrix(); //4x2 blocks times 2x8 blocks gives 4x8 blocks
+        if(product2.nonZeros() != product.nonZeros() || product48.nonZeros() != product.nonZeros())
+            return false;
+        for(int row=0; row < 10; row++){
+            for(int col=0; col < 10; col++){
+                if(product2.at(row,col) != product.at(row,col) || product48.at(row,col) != product.at(row,col))
+                    return false;
+            }
+        }
+        
+        SparseMatrix blockDiagonal(9,9);
+        for(int row=0; row < 9; row++){
+            for(int col = row / 2 * 2; col < row / 2 * 2 + 2 && col < 9; col++){
+                blockDiagonal[row][col] = 1;
+            }
+        }
+        BlockShape shape = blockDiagonal.detectBlockShape();
+        BlockShape scattered = a.detectBlockShape();
+        return shape.rows == 2 && shape.cols == 2 && shape.fill > 0.8 && scattered.rows < 8;
+    }
+    
+    
+    /*
+    Unit test for row indexes. Fills a long row in scrambled column order and checks that the row stays
+     sorted, that its index follows every insert past the point where it switches to hashing, and that
+     reads agree with a dense copy before and after bulk edits drop the index.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixRowIndexUnitTest(){
+        const int n = 5000;
+        vector<double> dense(n, 0.);
+        ElementList list(n);
+        for(int i=0; i < 3000; i++){
+            int col = (int)((long long)i * 7919 % n);
+            list[col] = dense[col] = i % 13 + 1;
+        }
+        if(list.getIndex() == nullptr || list.getIndex()->size() != 3000)
+            return false;
+        int previous = -1;
+        for(Element *ptr = list.getList(); ptr != nullptr; ptr = ptr->next){ //Also drops the index
+            if(ptr->col <= previous)
+                return false;
+            previous = ptr->col;
+        }
+        
+        list.buildIndex();
+        const ElementList &constList = list;
+        ElementList copy = list; //Copies and bulk edits leave the row without an index
+        copy.axpy(1, list);
+        const ElementList &constCopy = copy;
+        if(constList.getIndex() == nullptr || constList.getIndex()->size() != 3000 || copy.getIndex() != nullptr)
+            return false;
+        for(int col=0; col < n; col++){
+            if(constList[col] != dense[col] || list.getIth(col) != dense[col] || constCopy[col] != 2 * dense[col])
+                return false;
+        }
+        copy[n-1] += 1; //Walks the whole row, so the row is indexed again
+        if(copy.getIndex() == nullptr || copy.getIndex()->size() != (dense[n-1] == 0 ? 3001u : 3000u) || copy.getIth(n-1) != 2 * dense[n-1] + 1)
+            return false;
+        
+        SparseMatrix matrix(2, n);
+        for(int col=0; col < n; col += 3){
+            matrix[1][col] = col;
+        }
+        matrix[0][4] = 1;
+        matrix.indexRows();
+        const SparseMatrix &constMatrix = matrix;
+        const BasicRowIndex<T, Index> *rowIndex = matrix.rows[1].getIndex();
+        if(matrix.rows[0].getIndex() != nullptr || rowIndex == nullptr || rowIndex->size() != (size_t)(n + 2) / 3)
+            return false;
+        for(int col=0; col < n; col++){
+            if(constMatrix[1][col] != (col % 3 == 0 ? col : 0))
+                return false;
+        }
+        return constMatrix[0][4] == 1 && constMatrix[0][5] == 0;
+    }
+    
+    
+    /*
+    Unit test for instrumentation. Runs a few operations on small matrices whose counts are known and checks
+     the difference between snapshots taken around them: the exact counts when compiled with
+     SPARSEMATRIX_INSTRUMENT, and nothing at all otherwise.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixInstrumentationUnitTest(){
+        Instrumentation::Snapshot before = Instrumentation::snapshot();
+        Instrumentation::Snapshot during;
+        {
+            BasicSparseMatrix a(3, 3);
+            a[0][0] = 1;
+            a[0][2] = 2; //Steps over the Element at column 0
+            a[2][1] = 3;
+            if(a.rows[0].getIth(2) != 2) //Steps over column 0 again
+                return false;
+            BasicSparseMatrix copy = a;
+            BasicSparseMatrix product = a * copy; //Three multiply-adds, three Elements once thawed
+            BasicSparseMatrix transposed = a.tr();
+            BasicSparseMatrix sum = a + copy; //Copies a, then adds copy in without new Elements
+            copy = a; //Frees copy's three Elements
+            during = Instrumentation::snapshot() - before;
+            if(product.nonZeros() != 3 || sum.nonZeros() != 3 || transposed.nonZeros() != 3)
+                return false;
+        }
+        Instrumentation::Snapshot used = Instrumentation::snapshot() - before;
+        
+        if(!Instrumentation::enabled()){
+            for(int i=0; i < Instrumentation::numCounters; i++){
+                if(used.counters[i] != 0)
+                    return false;
+            }
+            for(int i=0; i < Instrumentation::numOperations; i++){
+                if(used.calls[i] != 0 || used.nanoseconds[i] != 0)
+                    return false;
+            }
+            return true;
+        }
+        
+        const uint64_t expectedCalls[Instrumentation::numOperations] = {1, 1, 1, 2, 1}; //Transpose, Multiply, Add, Assign, Copy
+        for(int i=0; i < Instrumentation::numOperations; i++){
+            if(during.calls[i] != expectedCalls[i])
+                return false;
+        }
+        return during.counters[Instrumentation::ElementAllocations] == 18
+            && during.counters[Instrumentation::ElementFrees] == 3
+            && during.counters[Instrumentation::NodesTraversed] == 2
+            && during.counters[Instrumentation::NonZerosInserted] == 3
+            && during.counters[Instrumentation::Flops] == 6
+            && used.counters[Instrumentation::ElementFrees] == 18;
+    }
+    
+    
+    /*
+    Unit test for SellMatrix. Converts a matrix with empty rows, a few long rows and a row count which is not
+     a multiple of the chunk height, and checks the row order, the padding, spmv and the conversion back.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixSellUnitTest(){
+        const int n = 45, m = 40;
+        SparseMatrix a(n, m);
+        vector<int> length(n);
+        for(int row=0; row < n; row++){
+            length[row] = row % 7 == 0 ? 0 : (row % 11 == 0 ? m : row % 5 + 1);
+            for(int i=0; i < length[row]; i++){
+                a[row][(row * 13 + i * 3) % m] = (row + i) % 9 - 4;
+            }
+        }
+        BasicSellMatrix<T, Index, 8> sell(a, 16);
+        BasicSellMatrix<T, Index, 4> unsorted(a, 1);
+        const vector<Index> &order = sell.permutation();
+        vector<bool> seen(n, false);
+        for(int i=0; i < n; i++){
+            if(seen[order[i]] || (i % 16 != 0 && length[order[i-1]] < length[order[i]]))
+                return false;
+            seen[order[i]] = true;
+            if(unsorted.permutation()[i] != i)
+                return false;
+        }
+        size_t unsortedSlots = BasicSellMatrix<T, Index, 8>(a, 1).slots();
+        size_t fullySortedSlots = BasicSellMatrix<T, Index, 8>(a, n).slots();
+        if(sell.nonZeros() != unsorted.nonZeros() || fullySortedSlots > sell.slots() || sell.slots() >= unsortedSlots)
+            return false;
+        
+        double x[m], y[n], ySell[n], yUnsorted[n];
+        for(int col=0; col < m; col++){
+            x[col] = col % 6 - 2;
+        }
+        for(int row=0; row < n; row++){
+            y[row] = ySell[row] = yUnsorted[row] = row;
+        }
+        a.spmv(y, x, 2, 1);
+        sell.spmv(ySell, x, 2, 1);
+        unsorted.spmv(yUnsorted, x, 2, 1);
+        SparseMatrix back = sell.toSparseMatrix();
+        for(int row=0; row < n; row++){
+            if(ySell[row] != y[row] || yUnsorted[row] != y[row])
+                return false;
+            for(int col=0; col < m; col++){
+                if(back.at(row,col) != a.at(row,col))
+                    return false;
+            }
+        }
+        return true;
+    }
+    
+    
+    /*
+    Unit test for reordering. Numbers the points of a grid, plus an unconnected path and an isolated row, in
+     scrambled order, and checks that Reverse Cuthill-McKee brings the bandwidth down to about the grid's width,
+     that the permuted matrix holds the same values, and that rows and columns can be permuted separately.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixReorderUnitTest(){
+        const int side = 12, n = side * side + 6;
+        vector<int> label(n);
+        for(int i=0; i < n; i++){
+            label[i] = (int)((long long)i * 97 % n); //97 and n share no factor, so this is a permutation
+        }
+        SparseMatrix a(n, n);
+        for(int i=0; i < side * side; i++){
+            a[label[i]][label[i]] = 4;
+            if(i % side != side - 1)
+                a[label[i]][label[i+1]] = a[label[i+1]][label[i]] = -1;
+            if(i + side < side * side)
+                a[label[i]][label[i+side]] = a[label[i+side]][label[i]] = -2;
+        }
+        for(int i = side * side; i < n - 2; i++){
+            a[label[i]][label[i+1]] = 1; //Only one direction, so the graph is taken from a + a.tr()
+        }
+        
+        Reordering rcm = a.reordered(Ordering::ReverseCuthillMcKee);
+        Reordering degree = a.reordered(Ordering::Degree);
+        vector<bool> seen(n, false);
+        for(int i=0; i < n; i++){
+            if(seen[rcm.rowOrder[i]])
+                return false;
+            seen[rcm.rowOrder[i]] = true;
+        }
+        if(rcm.bandwidthBefore != a.bandwidth() || rcm.bandwidthAfter > side + 1 || rcm.bandwidthAfter >= rcm.bandwidthBefore
+           || rcm.profileAfter >= rcm.profileBefore || rcm.matrix.nonZeros() != a.nonZeros() || rcm.matrix.isFrozen())
+            return false;
+        for(int i=0; i < n; i++){
+            for(int j=0; j < n; j++){
+                if(rcm.matrix.at(i,j) != a.at(rcm.rowOrder[i], rcm.colOrder[j]) || degree.matrix.at(i,j) != a.at(degree.rowOrder[i], degree.rowOrder[j]))
+                    return false;
+            }
+        }
+        vector<int> neighbours(n, 0);
+        for(int i=0; i < n; i++){
+            for(int j=0; j < n; j++){
+                if(i != j && (a.at(i,j) != 0 || a.at(j,i) != 0))
+                    neighbours[i]++;
+            }
+        }
+        for(int i=1; i < n; i++){
+            if(neighbours[degree.rowOrder[i-1]] < neighbours[degree.rowOrder[i]])
+                return false;
+        }
+        if(neighbours[degree.rowOrder[0]] != 4 || degree.rowOrder[n-1] != label[n-1]) //The isolated row comes last
+            return false;
+        
+        SparseMatrix wide(3, 4);
+        wide[0][0] = 1;
+        wide[1][3] = 2;
+        wide[2][1] = 3;
+        wide.freeze();
+        vector<Index> rowOrder = {2, 0, 1};
+        vector<Index> colOrder = {3, 2, 1, 0};
+        SparseMatrix moved = wide.permuted(rowOrder, colOrder);
+        return moved.isFrozen() && moved.at(0,2) == 3 && moved.at(1,3) == 1 && moved.at(2,0) == 2 && moved.nonZeros() == 3;
+    }
+    
+    
+    /*
+    Unit test for MultiplyPlan. Plans a product once, then executes it for new values of both matrices, from
+     list and frozen forms and from two threads at once, checking every result against a*b.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixMultiplyPlanUnitTest(){
+        SparseMatrix a(30, 25), b(25, 20);
+        for(int i=0; i < 30 * 25; i += 7){
+            a[i / 25][i % 25] = i % 5 + 1;
+        }
+        for(int i=0; i < 25 * 20; i += 3){
+            b[i / 20][i % 20] = i % 4 - 1; //Some zeros, so products cancel and stay in the pattern
+        }
+        BasicMultiplyPlan<T, Index> plan(a, b);
+        SparseMatrix product = plan.newProduct();
+        SparseMatrix other = plan.newProduct();
+        if(!plan.matches(a, b) || plan.matches(b, a) || plan.nonZeros() < (a * b).eval().nonZeros())
+            return false;
+        
+        for(int round=0; round < 3; round++){
+            for(int i=0; i < 30 * 25; i += 7){
+                a[i / 25][i % 25] = (i + round) % 6 - 2;
+            }
+            SparseMatrix frozenB = b;
+            frozenB.freeze();
+            SparseMatrix expected = a * b;
+            SparseMatrix twice = 2 * expected;
+            SparseMatrix doubled = a;
+            doubled *= 2;
+            
+            thread second([&]{ plan.execute(doubled, frozenB, other); });
+            plan.execute(a, round == 0 ? b : frozenB, product);
+            second.join();
+            for(int row=0; row < 30; row++){
+                for(int col=0; col < 20; col++){
+                    if(product.at(row,col) != expected.at(row,col) || other.at(row,col) != twice.at(row,col))
+                        return false;
+                }
+            }
+        }
+        return product.nonZeros() == plan.nonZeros();
+    }
+
+
+    /*
+    Unit test for DeltaMatrix. Four threads add into one matrix with a small threshold, so merges run while
+     they write, then single threaded updates with the Last and Max policies are checked against a matrix
+     edited through [][].
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixDeltaUnitTest(){
+        BasicDeltaMatrix<T, Index> sums(20, 30, DuplicatePolicy::Sum, 50);
+        vector<thread> writers;
+        for(int w=0; w < 4; w++){
+            writers.push_back(thread([&sums, w]{
+                for(int i=0; i < 1000; i++){
+                    sums.update(i % 20, (i * 7 + w) % 30, 1);
+                }
+            }));
+        }
+        for(size_t w=0; w < writers.size(); w++){
+            writers[w].join();
+        }
+        SparseMatrix counts(20, 30);
+        for(int w=0; w < 4; w++){
+            for(int i=0; i < 1000; i++){
+                counts[i % 20][(i * 7 + w) % 30] += 1;
+            }
+        }
+        for(int row=0; row < 20; row++){
+            for(int col=0; col < 30; col++){
+                if(sums.at(row,col) != counts.at(row,col))
+                    return false;
+            }
+        }
+        if(sums.pending() != 0 || !sums.matrix().isFrozen() || sums.nonZeros() != counts.nonZeros())
+            return false;
+
+        SparseMatrix start(6, 8);
+        start[0][0] = 5;
+        start[2][3] = -1;
+        start[5][7] = 2;
+        BasicDeltaMatrix<T, Index> lasts(start);
+        BasicDeltaMatrix<T, Index> largest(start, DuplicatePolicy::Max);
+        SparseMatrix expectedLast = start;
+        vector<T> maxima(6 * 8, 0);
+        vector<bool> stored(6 * 8, false);
+        maxima[0] = 5, maxima[2 * 8 + 3] = -1, maxima[5 * 8 + 7] = 2;
+        stored[0] = stored[2 * 8 + 3] = stored[5 * 8 + 7] = true;
+        for(int i=0; i < 40; i++){
+            int row = i * 5 % 6, col = i * 3 % 8;
+            T value = i % 9 - 4;
+            lasts.update(row, col, value);
+            largest.update(row, col, value);
+            expectedLast[row][col] = value;
+            maxima[row * 8 + col] = stored[row * 8 + col] ? max(maxima[row * 8 + col], value) : value;
+            stored[row * 8 + col] = true;
+            if(i == 20 && (lasts.pending() != 21 || lasts.at(row,col) != value || lasts.pending() != 0))
+                return false;
+        }
+        for(int row=0; row < 6; row++){
+            for(int col=0; col < 8; col++){
+                if(lasts.at(row,col) != expectedLast.at(row,col) || largest.at(row,col) != maxima[row * 8 + col])
+                    return false;
+            }
+        }
+        return lasts.nonZeros() == expectedLast.nonZeros();
+    }
+
+
+    /*
+    Unit test for VersionedMatrix. Checks staging, publishing and erasing from one thread, then has three
+     readers take snapshots while a writer publishes 2000 versions. Version v moves every one of the first
+     100 rows' single Element to column v%10 with the value v, so a snapshot mixing two versions, a version
+     older than one already published when the snapshot was taken, or one older than the reader's previous
+     snapshot all fail the test. Rows 100 to 199 never change and are shared by every version.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixVersionedUnitTest(){
+        SparseMatrix start(200, 10);
+        for(int row=100; row < 200; row++){
+            start[row][row % 10] = row;
+        }
+        BasicVersionedMatrix<T, Index> versioned(start);
+        {
+            typename BasicVersionedMatrix<T, Index>::Snapshot first = versioned.snapshot();
+            versioned.set(3, 5, 2);
+            versioned.set(3, 5, 4);
+            versioned.set(70, 1, 1);
+            if(versioned.snapshot().at(3,5) != 0 || versioned.publish() != 1)
+                return false;
+            typename BasicVersionedMatrix<T, Index>::Snapshot second = versioned.snapshot();
+            versioned.erase(70, 1);
+            versioned.erase(71, 1); //Nothing there
+            versioned.publish();
+            typename BasicVersionedMatrix<T, Index>::Snapshot third = versioned.snapshot();
+            if(first.at(3,5) != 0 || second.at(3,5) != 4 || second.at(70,1) != 1 || third.at(70,1) != 0)
+                return false;
+            if(first.nonZeros() != 100 || second.nonZeros() != 102 || third.nonZeros() != 101 || third.version() != 2)
+                return false;
+            SparseMatrix copy = third.toSparseMatrix();
+            if(!copy.isFrozen() || copy.at(3,5) != 4 || copy.at(150,0) != 150 || copy.nonZeros() != 101)
+                return false;
+            if(versioned.reclaim() != 2) //first and second still read what the publishes replaced
+                return false;
+        }
+        versioned.erase(3, 5);
+        versioned.publish();
+        if(versioned.reclaim() != 0)
+            return false;
+
+        const int numVersions = 2000;
+        atomic<uint64_t> published(versioned.version());
+        atomic<bool> writing(true), consistent(true);
+        vector<thread> readers;
+        for(int r=0; r < 3; r++){
+            readers.push_back(thread([&]{
+                uint64_t lastSeen = 0;
+                while(writing.load()){
+                    uint64_t before = published.load();
+                    typename BasicVersionedMatrix<T, Index>::Snapshot snapshot = versioned.snapshot();
+                    uint64_t seen = snapshot.version();
+                    bool ok = seen >= before && seen >= lastSeen;
+                    uint64_t v = seen - 3; //The first 3 versions were published above
+                    for(int row=0; row < 100 && ok && v > 0; row++){
+                        ok = snapshot.at(row, (Index)(v % 10)) == (T)v;
+                    }
+                    for(int row=100; row < 200 && ok; row++){
+                        ok = snapshot.at(row, row % 10) == row;
+                    }
+                    if(!ok || snapshot.nonZeros() != (v > 0 ? 200u : 100u))
+                        consistent.store(false);
+                    lastSeen = seen;
+                }
+            }));
+        }
+        for(int v=1; v <= numVersions; v++){
+            for(int row=0; row < 100; row++){
+                if(v > 1)
+                    versioned.erase(row, (v - 1) % 10);
+                versioned.set(row, v % 10, v);
+            }
+            published.store(versioned.publish());
+        }
+        writing.store(false);
+        for(size_t r=0; r < readers.size(); r++){
+            readers[r].join();
+        }
+        return consistent.load() && versioned.version() == numVersions + 3 && versioned.reclaim() == 0;
+    }
+
+
+    /*
+    Unit test for maskedProduct. Every mode is checked against the full product, from list and frozen forms,
+     with a mask holding some explicit zeros and rows of very different lengths so both kernels are used.
+     Then counts the triangles of a small graph as the sum of A*A masked by A, divided by six.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixMaskedUnitTest(){
+        SparseMatrix a(30, 25), b(25, 40);
+        for(int i=0; i < 30 * 25; i += 3){
+            a[i / 25][i % 25] = i % 5 - 2;
+        }
+        for(int i=0; i < 25 * 40; i += 2){
+            b[i / 40][i % 40] = i % 7 - 3;
+        }
+        vector<Triplet> maskEntries;
+        for(int row=0; row < 30; row++){
+            for(int col=0; col < 40; col += 1 + row % 13){ //From every column to only a few
+                maskEntries.push_back(Triplet(row, col, (row + col) % 4 == 0 ? 0 : 1));
+            }
+        }
+        SparseMatrix mask = SparseMatrix::fromTriplets(30, 40, maskEntries.begin(), maskEntries.end());
+        SparseMatrix full = a * b;
+        
+        MaskMode modes[] = {MaskMode::Values, MaskMode::Structure, MaskMode::ComplementValues, MaskMode::ComplementStructure};
+        for(int m=0; m < 4; m++){
+            for(int frozenInputs=0; frozenInputs < 2; frozenInputs++){
+                SparseMatrix lhs = a, rhs = b;
+                if(frozenInputs){
+                    lhs.freeze();
+                    rhs.freeze();
+                }
+                SparseMatrix masked = lhs.maskedProduct(rhs, mask, modes[m]);
+                if(masked.isFrozen() != (frozenInputs == 1))
+                    return false;
+                vector<char> inMask(30 * 40, 0);
+                for(size_t i=0; i < maskEntries.size(); i++){
+                    if(modes[m] == MaskMode::Structure || modes[m] == MaskMode::ComplementStructure || maskEntries[i].value != 0)
+                        inMask[maskEntries[i].row * 40 + maskEntries[i].col] = 1;
+                }
+                bool complement = modes[m] == MaskMode::ComplementValues || modes[m] == MaskMode::ComplementStructure;
+                size_t expectedNonZeros = 0;
+                for(int row=0; row < 30; row++){
+                    for(int col=0; col < 40; col++){
+                        T expected = (inMask[row * 40 + col] != 0) != complement ? full.at(row,col) : 0;
+                        expectedNonZeros += expected != 0;
+                        if(masked.at(row,col) != expected)
+                            return false;
+                    }
+                }
+                if(masked.nonZeros() != expectedNonZeros)
+                    return false;
+            }
+        }
+        
+        SparseMatrix graph(6, 6); //Two triangles, 0-1-2 and 2-3-4, and an edge 4-5
+        int edges[][2] = {{0,1}, {1,2}, {0,2}, {2,3}, {3,4}, {2,4}, {4,5}};
+        for(int e=0; e < 7; e++){
+            graph[edges[e][0]][edges[e][1]] = 1;
+            graph[edges[e][1]][edges[e][0]] = 1;
+        }
+        SparseMatrix paths = graph.maskedProduct(graph, graph, MaskMode::Structure);
+        T total = 0;
+        for(int row=0; row < 6; row++){
+            for(int col=0; col < 6; col++){
+                total += paths.at(row,col);
+            }
+        }
+        return total / 6 == 2;
+    }
+
+
+    /*
+    Checks a product in the semiring S against a dense triple loop over the stored Elements, for the full
+    product from frozen and list forms and for a product masked by the lhs.
+    */
+    template <class S>
+    static bool semiringProductMatches(const SparseMatrix &a, const SparseMatrix &b){
+        int n = a.numRows, m = a.numCols, p = b.numCols;
+        vector<T> expected(n * p, S::zero());
+        for(int i=0; i < n; i++){
+            a.forEachInRow(i, [&](Index k, T lhsVal){
+                b.forEachInRow(k, [&](Index j, T rhsVal){
+                    expected[i * p + j] = S::add(expected[i * p + j], S::multiply(lhsVal, rhsVal));
+                });
+            });
+        }
+        SparseMatrix frozenA = a;
+        frozenA.freeze();
+        SparseMatrix product = a.multiplyOver<S>(b), frozenProduct = frozenA.multiplyOver<S>(b);
+        SparseMatrix masked = a.maskedProduct<S>(b, a, MaskMode::Structure);
+        if(product.isFrozen() || !frozenProduct.isFrozen() || m != b.numRows)
+            return false;
+        auto holds = [](const SparseMatrix &matrix, int row, int col){
+            bool found = false;
+            matrix.forEachInRow(row, [&](int stored, T){ found = found || stored == col; });
+            return found;
+        };
+        for(int i=0; i < n; i++){
+            for(int j=0; j < p; j++){
+                T value = expected[i * p + j];
+                bool stored = value != S::zero();
+                T maskedValue = holds(a, i, j) ? value : S::zero();
+                bool maskedStored = maskedValue != S::zero();
+                if(holds(product, i, j) != stored || holds(frozenProduct, i, j) != stored || holds(masked, i, j) != maskedStored)
+                    return false;
+                if((stored && (product.at(i,j) != value || frozenProduct.at(i,j) != value)) || (maskedStored && masked.at(i,j) != maskedValue))
+                    return false;
+            }
+        }
+        return true;
+    }
+    
+    
+    /*
+    Unit test for multiplyOver and the predefined semirings, on a weighted graph with some zero weights.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixSemiringUnitTest(){
+        SparseMatrix a(20, 20), b(20, 20);
+        for(int i=0; i < 400; i += 3){
+            a[i / 20][i % 20] = i % 7;
+            b[i % 20][i / 20] = (i % 5) * 0.5;
+        }
+        if(!semiringProductMatches<PlusTimes<T> >(a, b) || !semiringProductMatches<MinPlus<T> >(a, b)
+           || !semiringProductMatches<MaxTimes<T> >(a, b) || !semiringProductMatches<OrAnd<T> >(a, b))
+            return false;
+        
+        SparseMatrix path(4, 4); //0 -> 1 -> 3 costs 5, 0 -> 2 -> 3 costs 3
+        path[0][1] = 1;
+        path[1][3] = 4;
+        path[0][2] = 2;
+        path[2][3] = 1;
+        SparseMatrix twoSteps = path.multiplyOver<MinPlus<T> >(path);
+        SparseMatrix reach = path.multiplyOver<OrAnd<T> >(path);
+        SparseMatrix plain = path.multiplyOver<PlusTimes<T> >(path);
+        return twoSteps.nonZeros() == 1 && twoSteps.at(0,3) == 3 && reach.at(0,3) == 1 && plain.at(0,3) == 6;
+    }
+    
+    
+    /*
+    Unit test for spmm against a dense product, for widths that use every panel size and leave remainders,
+     on thawed and frozen matrices and with and without beta. The values are small integers so the sums are exact.
+    Post: returns true if the unit test passes, or false if it fails
+    */
+    bool sparseMatrixSpmmUnitTest(){
+        const int n = 37, m = 29;
+        SparseMatrix a(n, m);
+        for(int i=0; i < n * m; i += 5){
+            a[i / m][i % m] = i % 9 - 4;
+        }
+        a[3][0] = 0; //Leaves a row without Elements
+        for(int frozen=0; frozen < 2; frozen++){
+            const int widths[5] = {1, 7, 8, 33, 70};
+            for(int w=0; w < 5; w++){
+                int k = widths[w];
+                vector<T> x(m * k), y(n * k), z(n * k, -1), expected(n * k, 0);
+                for(int i=0; i < m * k; i++){
+                    x[i] = i % 11 - 5;
+                }
+                for(int i=0; i < n * k; i++){
+                    y[i] = i % 3;
+                }
+                for(int i=0; i < n; i++){
+                    a.forEachInRow(i, [&](int col, T value){
+                        for(int j=0; j < k; j++){
+                            expected[i * k + j] += value * x[col * k + j];
+                        }
+                    });
+                }
+                a.spmm(z.data(), x.data(), k); //beta of zero ignores what z held
+                a.spmm(y.data(), x.data(), k, 2, 3);
+                for(int i=0; i < n * k; i++){
+                    if(z[i] != expected[i] || y[i] != 2 * expected[i] + 3 * (i % 3))
+                        return false;
+                }
+            }
+            a.freeze();
+        }
+        return true;
+    }
+
+
+    /* Friends */
+    template <class U, class I> friend ostream &operator << (ostream &out, const BasicSparseMatrix<U, I> &matrix);
+    template <class U, class I> friend class BasicSparseMatrix;
+    template <class U, class I, int R, int C> friend class BasicBlockSparseMatrix;
+    template <class U, class I, int C> friend class BasicSellMatrix;
+    template <class U, class I> friend class BasicMultiplyPlan;
+    template <class U, class I> friend class BasicDeltaMatrix;
+    template <class U, class I> friend class BasicVersionedMatrix;
+    template <class U, class I> friend class BasicRowReference;
+private:
+    Index numRows;
+    Index numCols;
+    
+    ElementList *rows; //nullptr while the matrix is frozen
+    bool compressed;
+    CompressedStorage csr;
+    shared_ptr<ElementPool> pool;
+    
+    /*
+    Post: rows holds numRows empty ElementLists allocating from the matrix's pool. A default ElementPool is
+          created first if the matrix has none, as when it was frozen from the start or a move took it away.
+    */
+    void newRows(){
+        if(!pool)
+            pool = make_shared<ElementPool>();
+        rows = new ElementList[numRows];
+        for(Index i=0; i < numRows; i++){
+            rows[i].set(numCols, pool);
+        }
+    }
+    
+    /*
+    Post: returns a view of the row, pointing either at its ElementList or at its part of the compressed arrays.
+    */
+    RowView rowView(Index row) const {
+        if(compressed)
+            return RowView(csr.indices.data() + csr.offsets[row], csr.values.data() + csr.offsets[row],
+                           csr.offsets[row+1] - csr.offsets[row], numCols);
+        const ElementList &list = rows[row];
+        return RowView(list.getList(), numCols, list.getIndex());
+    }
+    
+    /*
+    Post: returns the row's ElementList, thawing the matrix first if it is frozen.
+    */
+    ElementList & writableRow(Index row){
+        thaw();
+        return rows[row];
+    }
+    
+    /*
+    Frees every row. When the rows hold every Element the pool has handed out, no list outside this matrix
+    can be using it, so the Elements are dropped with the pool's slabs in one go instead of being released
+    one by one. Lists elsewhere that share the pool but hold no Elements keep working, as the pool starts
+    new slabs for them.
+    Post: rows is nullptr
+    */
+    void deleteRows(){
+        bool ownsPool = rows != nullptr && pool;
+        size_t held = 0;
+        for(Index i=0; ownsPool && i < numRows; i++){ //Rows may have been given a list from elsewhere by a move
+            ownsPool = rows[i].pool == pool;
+            held += rows[i].length;
+        }
+        if(ownsPool && pool->elementsInUse() == held){
+            SPARSEMATRIX_COUNT(ElementFrees, nonZeros());
+            for(Index i=0; i < numRows; i++){
+                rows[i].list = nullptr;
+            }
+            delete [] rows;
+            pool->releaseAll();
+        }
+        else
+            delete [] rows; //Will call destructors for each ElementList in the rows array
+        rows = nullptr;
+    }
+    
+    static const size_t parallelThreshold = 1 << 15; //Fewer Elements than this are not worth waking the WorkerPool for
+    static const size_t spmmChunkSize = 4096; //Elements spmm multiplies by every panel before moving on
+    
+    /*
+    Creates a frozen n x m matrix which takes over the compressed sparse row arrays in storage. A matrix
+    computed from others passes the pool of the one it follows as source, so it allocates from the same kind
+    of pool once it is thawed. No pool is created until then.
+    */
+    BasicSparseMatrix(Index n, Index m, CompressedStorage &&storage, const shared_ptr<ElementPool> &source=shared_ptr<ElementPool>()){
+        numRows = n;
+        numCols = m;
+        compressed = true;
+        csr = move(storage);
+        pool = newPoolFor(source);
+        rows = nullptr;
+    }
+    
+    /*
+    Post: returns the pool a copy of a matrix allocating from source starts with (see ElementPool::newPool).
+    */
+    static shared_ptr<ElementPool> newPoolFor(const shared_ptr<ElementPool> &source){
+        return source ? source->newPool() : shared_ptr<ElementPool>();
+    }
+    
+    /*
+    Builds the graph of the matrix's Elements with each edge going both ways and without self loops: the
+    neighbours of row i are adjacent[offsets[i]] .. adjacent[offsets[i+1]-1], in increasing order.
+    Pre:  the matrix is square.
+    */
+    void symmetricPattern(vector<size_t> &offsets, vector<Index> &adjacent) const {
+        offsets.assign(numRows + 1, 0);
+        for(Index row=0; row < numRows; row++){
+            forEachInRow(row, [&](Index col, T){
+                if(col != row){
+                    offsets[row+1]++;
+                    offsets[col+1]++;
+                }
+            });
+        }
+        for(Index row=0; row < numRows; row++){
+            offsets[row+1] += offsets[row];
+        }
+        adjacent.resize(offsets[numRows]);
+        vector<size_t> next(offsets.begin(), offsets.end() - 1);
+        for(Index row=0; row < numRows; row++){
+            forEachInRow(row, [&](Index col, T){
+                if(col != row){
+                    adjacent[next[row]++] = col;
+                    adjacent[next[col]++] = row;
+                }
+            });
+        }
+        
+        //An edge stored in both directions was added twice, so sort every list and drop the repeats
+        size_t kept = 0;
+        for(Index row=0; row < numRows; row++){
+            typename vector<Index>::iterator first = adjacent.begin() + offsets[row];
+            sort(first, adjacent.begin() + offsets[row+1]);
+            size_t length = unique(first, adjacent.begin() + offsets[row+1]) - first;
+            offsets[row] = kept;
+            copy(first, first + length, adjacent.begin() + kept);
+            kept += length;
+        }
+        offsets[numRows] = kept;
+        adjacent.resize(kept);
+    }
+    
+    /*
+    Post: returns the rows ordered by their number of neighbours in the graph given by offsets, fewest first
+          or most first, with ties kept in row order.
+    */
+    vector<Index> orderedByDegree(const vector<size_t> &offsets, bool mostFirst) const {
+        vector<Index> order(numRows);
+        for(Index row=0; row < numRows; row++){
+            order[row] = row;
+        }
+        stable_sort(order.begin(), order.end(), [&](Index a, Index b){
+            size_t degreeA = offsets[a+1] - offsets[a], degreeB = offsets[b+1] - offsets[b];
+            return mostFirst ? degreeA > degreeB : degreeA < degreeB;
+        });
+        return order;
+    }
+    
+    /*
+    Finds a pseudo-peripheral row of start's connected part of the graph: a breadth first search is started
+    from a row of lowest degree in the last level of the previous one for as long as the number of levels grows.
+    Pre:  level holds -1 for every row.
+    Post: returns the row, and level holds -1 for every row again.
+    */
+    static Index pseudoPeripheral(Index start, const vector<size_t> &offsets, const vector<Index> &adjacent, vector<Index> &level){
+        vector<Index> queue;
+        Index root = start;
+        Index depth = -1;
+        while(true){
+            queue.clear();
+            queue.push_back(root);
+            level[root] = 0;
+            for(size_t head=0; head < queue.size(); head++){
+                Index row = queue[head];
+                for(size_t k = offsets[row]; k < offsets[row+1]; k++){
+                    if(level[adjacent[k]] < 0){
+                        level[adjacent[k]] = level[row] + 1;
+                        queue.push_back(adjacent[k]);
+                    }
+                }
+            }
+            Index rootDepth = level[queue.back()];
+            Index candidate = queue.back();
+            for(size_t i = queue.size(); i > 0 && level[queue[i-1]] == rootDepth; i--){
+                Index row = queue[i-1];
+                if(offsets[row+1] - offsets[row] < offsets[candidate+1] - offsets[candidate])
+                    candidate = row;
+            }
+            for(size_t i=0; i < queue.size(); i++){
+                level[queue[i]] = -1;
+            }
+            if(rootDepth <= depth)
+                return root;
+            depth = rootDepth;
+            if(candidate == root)
+                return root;
+            root = candidate;
+        }
+    }
+    
+    /*
+    Sorts a row's (col, value) pairs by column, keeping pairs with the same column in their original order.
+    */
+    static void sortByColumn(vector<pair<Index, T> > &row){
+        if(row.size() > 16){
+            stable_sort(row.begin(), row.end(), [](const pair<Index, T> &a, const pair<Index, T> &b){
+                return a.first < b.first;
+            });
+            return;
+        }
+        for(size_t i=1; i < row.size(); i++){ //Insertion sort is quicker for the short rows most matrices have
+            pair<Index, T> entry = row[i];
+            size_t j = i;
+            for(; j > 0 && row[j-1].first > entry.first; j--){
+                row[j] = row[j-1];
+            }
+            row[j] = entry;
+        }
+    }
+    
+    /*
+    Multiplies count consecutive rows, row r being Elements offsets[r] .. offsets[r+1]-1 of cols and values,
+    by every panel of the k columns of x, into the rows of y (see spmm).
+    */
+    static void spmmChunk(const Index *cols, const T *values, const size_t *offsets, Index count,
+                          const T *x, T *y, Index k, T alpha, T beta){
+        Index done = 0;
+        for(; done + 32 <= k; done += 32){
+            spmmPanel<32>(cols, values, offsets, count, x + done, y + done, k, alpha, beta);
+        }
+        for(; done + 8 <= k; done += 8){
+            spmmPanel<8>(cols, values, offsets, count, x + done, y + done, k, alpha, beta);
+        }
+        for(; done < k; done++){
+            spmmPanel<1>(cols, values, offsets, count, x + done, y + done, k, alpha, beta);
+        }
+    }
+    
+    template <int W>
+    static void spmmPanel(const Index *cols, const T *values, const size_t *offsets, Index count,
+                          const T *x, T *y, Index k, T alpha, T beta){
+        for(Index r=0; r < count; r++){
+            PanelKernel<T, W>::multiply(cols + offsets[r], values + offsets[r], offsets[r+1] - offsets[r],
+                                        x, (size_t)k, y + (size_t)r * k, alpha, beta);
+        }
+    }
+    
+    /*
+    Splits the rows into numBlocks contiguous blocks holding about the same number of Elements.
+    Post: returns numBlocks+1 boundaries, block b being rows [blocks[b], blocks[b+1]).
+    */
+    vector<Index> partitionRows(int numBlocks) const {
+        if(compressed)
+            return partitionByPrefix(csr.offsets.data(), numRows, numBlocks);
+        
+        vector<size_t> prefix(numRows + 1, 0);
+        for(Index row=0; row < numRows; row++){
+            size_t length = 0;
+            forEachInRow(row, [&](Index, T){ length++; });
+            prefix[row+1] = prefix[row] + length;
+        }
+        return partitionByPrefix(prefix.data(), numRows, numBlocks);
+    }
+    
+    /*
+    Splits count rows into numBlocks contiguous blocks of about the same weight, given the running totals
+    of the row weights in prefix (count+1 values starting at zero).
+    Post: returns numBlocks+1 boundaries, block b being rows [blocks[b], blocks[b+1]).
+    */
+    static vector<Index> partitionByPrefix(const size_t *prefix, Index count, int numBlocks){
+        vector<Index> blocks(numBlocks + 1, count);
+        blocks[0] = 0;
+        size_t total = prefix[count];
+        for(int b=1; b < numBlocks; b++){
+            size_t target = total / numBlocks * b + total % numBlocks * b / numBlocks;
+            Index row = (Index)(upper_bound(prefix, prefix + count + 1, target) - prefix) - 1;
+            blocks[b] = max(blocks[b-1], min(row, count));
+        }
+        return blocks;
+    }
+    
+    /*
+    Pre:  the matrix is frozen and rhs has the same size.
+    Post: returns alpha*self + beta*rhs, frozen, merging each compressed row with rhs's row in one pass.
+    */
+    BasicSparseMatrix mergedWith(const BasicSparseMatrix &rhs, T alpha, T beta) const {
+        CompressedStorage storage;
+        storage.offsets.resize(numRows + 1);
+        vector<Index> cols;
+        vector<T> values;
+        cols.reserve(csr.size());
+        values.reserve(csr.size());
+        for(Index row=0; row < numRows; row++){
+            size_t pos = csr.offsets[row];
+            size_t end = csr.offsets[row+1];
+            rhs.forEachInRow(row, [&](Index col, T value){
+                for(; pos < end && csr.indices[pos] < col; pos++){ //Elements only self has
+                    cols.push_back(csr.indices[pos]);
+                    values.push_back(alpha * csr.values[pos]);
+                }
+                cols.push_back(col);
+                if(pos < end && csr.indices[pos] == col)
+                    values.push_back(alpha * csr.values[pos++] + beta * value);
+                else
+                    values.push_back(beta * value);
+            });
+            for(; pos < end; pos++){
+                cols.push_back(csr.indices[pos]);
+                values.push_back(alpha * csr.values[pos]);
+            }
+            storage.offsets[row+1] = cols.size();
+        }
+        storage.indices.assign(move(cols));
+        storage.values.assign(move(values));
+        return BasicSparseMatrix(numRows, numCols, move(storage), this->pool);
+    }
+
+    /*
+    Pre:  the matrix and updates are frozen and the same size.
+    Post: returns the matrix with the Elements of updates merged in, frozen. Where both hold an Element the
+          two values are combined as policy says: added, the value of updates kept, or the larger kept.
+          Rows are shared over the WorkerPool, counting every merged row first and then writing it in place.
+    */
+    BasicSparseMatrix mergedUpdates(const BasicSparseMatrix &updates, DuplicatePolicy policy) const {
+        vector<size_t> weight(numRows + 1, 0);
+        for(Index row=0; row < numRows; row++){
+            weight[row+1] = weight[row] + 1 + (csr.offsets[row+1] - csr.offsets[row])
+                          + (updates.csr.offsets[row+1] - updates.csr.offsets[row]);
+        }
+        WorkerPool &workers = WorkerPool::shared();
+        int numParts = weight[numRows] < parallelThreshold ? 1 : (int)workers.size() * 4;
+        vector<Index> parts = partitionByPrefix(weight.data(), numRows, numParts);
+
+        CompressedStorage storage;
+        storage.offsets.assign(numRows + 1, 0);
+        size_t *offsets = storage.offsets.data();
+        workers.run(numParts, [&](int part){
+            for(Index row = parts[part]; row < parts[part+1]; row++){
+                offsets[row+1] = mergeUpdatedRow(updates, row, policy, nullptr, nullptr);
+            }
+        });
+        for(Index row=0; row < numRows; row++){
+            offsets[row+1] += offsets[row];
+        }
+        vector<Index> cols(offsets[numRows]);
+        vector<T> values(offsets[numRows]);
+        workers.run(numParts, [&](int part){
+            for(Index row = parts[part]; row < parts[part+1]; row++){
+                mergeUpdatedRow(updates, row, policy, cols.data() + offsets[row], values.data() + offsets[row]);
+            }
+        });
+        storage.indices.assign(move(cols));
+        storage.values.assign(move(values));
+        return BasicSparseMatrix(numRows, numCols, move(storage), this->pool);
+    }
+
+    /*
+    Merges one compressed row with the same row of updates, as mergedUpdates describes.
+    Post: returns the length of the merged row, and writes it to cols and values unless they are nullptr.
+    */
+    size_t mergeUpdatedRow(const BasicSparseMatrix &updates, Index row, DuplicatePolicy policy, Index *cols, T *values) const {
+        size_t pos = csr.offsets[row], end = csr.offsets[row+1];
+        size_t next = updates.csr.offsets[row], last = updates.csr.offsets[row+1];
+        size_t length = 0;
+        while(pos < end || next < last){
+            Index col;
+            T value;
+            if(next == last || (pos < end && csr.indices[pos] < updates.csr.indices[next])){ //Only the matrix has it
+                col = csr.indices[pos];
+                value = csr.values[pos++];
+            }
+            else if(pos == end || updates.csr.indices[next] < csr.indices[pos]){ //Only updates has it
+                col = updates.csr.indices[next];
+                value = updates.csr.values[next++];
+            }
+            else{
+                col = csr.indices[pos];
+                value = updates.csr.values[next++];
+                if(policy == DuplicatePolicy::Sum)
+                    value += csr.values[pos];
+                else if(policy == DuplicatePolicy::Max)
+                    value = max(value, csr.values[pos]);
+                pos++;
+            }
+            if(cols != nullptr){
+                cols[length] = col;
+                values[length] = value;
+            }
+            length++;
+        }
+        return length;
+    }
+
+    /*
+    Estimates the work of each row of self * rhs as one plus the total length of the rows of rhs it reads,
+    plus the length of the row of addend added to it.
+    Post: returns the running totals of the estimates, numRows+1 values starting at zero.
+    */
+    vector<size_t> productCosts(const BasicSparseMatrix &rhs, const BasicSparseMatrix *addend) const {
+        vector<size_t> rhsLength(rhs.numRows);
+        for(Index row=0; row < rhs.numRows; row++){
+            if(rhs.compressed)
+                rhsLength[row] = rhs.csr.offsets[row+1] - rhs.csr.offsets[row];
+            else
+                rhs.forEachInRow(row, [&](Index, T){ rhsLength[row]++; });
+        }
+        
+        vector<size_t> cost(numRows + 1, 0);
+        for(Index row=0; row < numRows; row++){
+            size_t work = 1;
+            forEachInRow(row, [&](Index col, T){ work += rhsLength[col]; });
+            if(addend != nullptr)
+                addend->forEachInRow(row, [&](Index, T){ work++; });
+            cost[row+1] = cost[row] + work;
+        }
+        return cost;
+    }
+    
+    
+    /*
+    Computes alpha*self*rhs + beta*addend, leaving out addend when it is nullptr. This is the kernel behind
+    every product expression, including a*b itself.
+    Creates a new matrix square containing multiplied values of the two product matrices.
+    If C = A*B, where A is size n x m and B is m x p then C is n x p
+    And C[i,j] = A[i,0]*B[0,j] + A[i,1]*B[1,j] + ... + A[i,m]*B[m,j]
+    
+    The product is built one row at a time (Gustavson's method): every stored Element A[i,k]
+    scales row k of B into a sparse accumulator for row i, so only stored nonzeros are ever
+    visited and the cost is proportional to the number of multiplications actually performed.
+    
+    Rows are shared over the WorkerPool by work stealing. A row's cost is estimated as the total
+    length of the rows of B it reads, the rows are cut into chunks of about equal estimated cost,
+    and threads which finish their own chunks early steal chunks from the others, so a few very long
+    rows do not hold up the rest. Each thread keeps its own accumulator and output buffer; once every row's length is
+    known the buffers are copied into place in parallel.
+    
+    The addend is fused in by seeding each row's accumulator with beta times the addend's row before the
+    products are added, and alpha is applied to each Element of self as its row of rhs is scaled. Values
+    which cancel out to zero are not stored.
+    
+    Pre:  rhs numRows must be the exact same as the lhs numCols, and addend is numRows x rhs numCols.
+    Post: returns alpha*self*rhs + beta*addend, frozen. Either operand may be frozen.
+    */
+    BasicSparseMatrix multiply(const BasicSparseMatrix &rhs, T alpha, const BasicSparseMatrix *addend, T beta) const {
+        return multiplyIn<PlusTimes<T> >(rhs, alpha, addend, beta);
+    }
+    
+    /*
+    The kernel of multiply() in any semiring: adds are Semiring::add, multiplies Semiring::multiply and the
+    values not stored are Semiring::zero(). Sums which reach the semiring's annihilator take no more products.
+    Post: returns alpha*self*rhs + beta*addend in Semiring, frozen.
+    */
+    template <class Semiring>
+    BasicSparseMatrix multiplyIn(const BasicSparseMatrix &rhs, T alpha, const BasicSparseMatrix *addend, T beta) const {
+        SPARSEMATRIX_TIME(Multiply);
+        Index p = rhs.numCols;
+        vector<size_t> cost = productCosts(rhs, addend);
+        //Every cost but the one per row and the addend's Elements is a multiply-add
+        SPARSEMATRIX_COUNT(Flops, 2 * (cost[numRows] - numRows - (addend == nullptr ? 0 : addend->nonZeros())));
+        WorkerPool &workers = WorkerPool::shared();
+        int numSlots = cost[numRows] < parallelThreshold ? 1 : (int)workers.size();
+        
+        //Rows are grouped into chunks of about equal estimated cost, and whole chunks are what threads
+        //take and steal. Each slot starts with an equal share of the chunks.
+        int numChunks = numSlots == 1 ? 1 : (int)min((size_t)numSlots * 256, (size_t)numRows + 1);
+        vector<Index> chunks = partitionByPrefix(cost.data(), numRows, numChunks);
+        vector<int> bounds(numSlots + 1);
+        for(int slot=0; slot <= numSlots; slot++){
+            bounds[slot] = (int)((size_t)numChunks * slot / numSlots);
+        }
+        
+        //Per-slot scratch space and output: the columns and values of the rows the slot computed, in the
+        //order it computed them, and the (first row, last row + 1) of each run of consecutive rows
+        vector<vector<Index> > slotCols(numSlots);
+        vector<vector<T> > slotValues(numSlots);
+        vector<vector<pair<Index, Index> > > slotRuns(numSlots);
+        vector<vector<T> > slotAccumulator(numSlots);
+        vector<vector<Index> > slotMarker(numSlots);
+        vector<vector<Index> > slotTouched(numSlots);
+        vector<size_t> rowLength(numRows);
+        
+        workers.runStealing(bounds, 1, [&](int firstChunk, int lastChunk, int slot){
+            Index begin = chunks[firstChunk], end = chunks[lastChunk];
+            vector<Index> &outCols = slotCols[slot];
+            vector<T> &outValues = slotValues[slot];
+            vector<pair<Index, Index> > &runs = slotRuns[slot];
+            if(!runs.empty() && runs.back().second == begin)
+                runs.back().second = end;
+            else
+                runs.push_back(make_pair(begin, end));
+            
+            //Sparse accumulator for the row being calculated: a dense value per column, a marker holding the
+            //last row which touched that column and the list of columns touched so far in the current row.
+            //Each row is handed to one slot only, so the markers never need resetting.
+            vector<T> &accumulator = slotAccumulator[slot];
+            vector<Index> &marker = slotMarker[slot];
+            vector<Index> &touched = slotTouched[slot];
+            if(marker.empty()){
+                accumulator.resize(p);
+                marker.assign(p, -1);
+                touched.resize(p);
+            }
+            
+            for(Index row = begin; row < end; row++){
+                Index numTouched = 0;
+                if(addend != nullptr){
+                    addend->forEachInRow(row, [&](Index col, T value){
+                        marker[col] = row;
+                        accumulator[col] = Semiring::multiply(beta, value);
+                        touched[numTouched++] = col;
+                    });
+                }
+                forEachInRow(row, [&](Index lhsCol, T lhsVal){
+                    lhsVal = Semiring::multiply(alpha, lhsVal);
+                    //Scale row lhsCol of rhs by lhsVal into the accumulator
+                    rhs.forEachInRow(lhsCol, [&](Index col, T rhsVal){
+                        if(marker[col] != row){ //First contribution to this column in the current row
+                            marker[col] = row;
+                            accumulator[col] = Semiring::multiply(lhsVal, rhsVal);
+                            touched[numTouched++] = col;
+                        }
+                        else if(!Semiring::hasAnnihilator || accumulator[col] != Semiring::annihilator())
+                            accumulator[col] = Semiring::add(accumulator[col], Semiring::multiply(lhsVal, rhsVal));
+                    });
+                });
+                
+                sort(touched.begin(), touched.begin() + numTouched);
+                size_t before = outCols.size();
+                for(Index i=0; i < numTouched; i++){
+                    Index col = touched[i];
+                    if(accumulator[col] == Semiring::zero())//if the value is zero, dont record it since its the default access value
+                        continue;
+                    outCols.push_back(col);
+                    outValues.push_back(accumulator[col]);
+                }
+                rowLength[row] = outCols.size() - before;
+            }
+        });
+        
+        CompressedStorage storage;
+        storage.offsets.resize(numRows + 1);
+        for(Index row=0; row < numRows; row++){
+            storage.offsets[row+1] = storage.offsets[row] + rowLength[row];
+        }
+        if(numSlots == 1){ //A single slot computed every row in order, so its buffers are already the arrays
+            storage.indices.assign(move(slotCols[0]));
+            storage.values.assign(move(slotValues[0]));
+        }
+        else{
+            storage.indices.resize(storage.offsets[numRows]);
+            storage.values.resize(storage.offsets[numRows]);
+            workers.run(numSlots, [&](int slot){
+                size_t pos = 0;
+                for(size_t r=0; r < slotRuns[slot].size(); r++){
+                    size_t first = storage.offsets[slotRuns[slot][r].first];
+                    size_t count = storage.offsets[slotRuns[slot][r].second] - first;
+                    copy(slotCols[slot].begin() + pos, slotCols[slot].begin() + pos + count, storage.indices.data() + first);
+                    copy(slotValues[slot].begin() + pos, slotValues[slot].begin() + pos + count, storage.values.data() + first);
+                    pos += count;
+                }
+            });
+        }
+        
+        return BasicSparseMatrix(numRows, p, move(storage), this->pool);
+    }
+    
+    /*
+    Post: returns the transpose of self (see tr).
+    */
+    BasicSparseMatrix transposed() const {
+        BasicSparseMatrix newMatrix(numCols, numRows, compressColumns(), pool); //The columns of self are the rows of the transpose
+        if(!compressed)
+            newMatrix.thaw();
+        return newMatrix;
+    }
+    
+    /*
+    Replaces the matrix with value, frozen if the matrix was frozen and thawed otherwise.
+    */
+    BasicSparseMatrix & assignKeepingFormat(BasicSparseMatrix &&value){
+        if(compressed)
+            value.freeze();
+        else
+            value.thaw();
+        return *this = move(value);
+    }
+    
+    /*
+    Evaluators for the lazy expressions. Each returns the value of an expression as a new matrix, picking
+    the most specific overload for the shape of the expression so products are fused with what is around
+    them. A product, or a sum holding one, is frozen when the product's left operand is; any other sum is
+    frozen when its left operand is.
+    */
+    static BasicSparseMatrix evaluate(const BasicSparseMatrix &matrix){
+        return matrix;
+    }
+    
+    template <class L, class R>
+    static BasicSparseMatrix evaluate(const MatrixProduct<L, R> &product){
+        return fusedProduct(product, 1, nullptr, 0);
+    }
+    
+    template <class L, class R>
+    static BasicSparseMatrix evaluate(const MatrixSum<L, R> &sum){
+        SPARSEMATRIX_TIME(Add);
+        return sumOf(sum.lhs, sum.alpha, sum.rhs, sum.beta, IsProductTerm<L>(), IsProductTerm<R>());
+    }
+    
+    template <class E>
+    static BasicSparseMatrix evaluate(const MatrixScaled<E> &scaled){
+        return scaledBy(scaled.operand, scaled.alpha, IsProductTerm<E>());
+    }
+    
+    template <class E>
+    static BasicSparseMatrix evaluate(const MatrixTranspose<E> &transpose){
+        SPARSEMATRIX_TIME(Transpose);
+        return transposeOf(transpose.operand);
+    }
+    
+    /*
+    Post: returns a reference to expression's value: the matrix itself, or the expression evaluated into temporary.
+    */
+    static const BasicSparseMatrix & evaluated(const BasicSparseMatrix &matrix, BasicSparseMatrix &){
+        return matrix;
+    }
+    
+    template <class E>
+    static const BasicSparseMatrix & evaluated(const E &expression, BasicSparseMatrix &temporary){
+        temporary = evaluate(expression);
+        return temporary;
+    }
+    
+    /*
+    Post: returns alpha*product + beta*addend, peeling any scale factors off the product and its left operand.
+    */
+    template <class L, class R>
+    static BasicSparseMatrix fusedProduct(const MatrixProduct<L, R> &product, T alpha, const BasicSparseMatrix *addend, T beta){
+        BasicSparseMatrix lhsValue, rhsValue;
+        const BasicSparseMatrix &lhs = evaluated(product.lhs, lhsValue);
+        const BasicSparseMatrix &rhs = evaluated(product.rhs, rhsValue);
+        BasicSparseMatrix newMatrix = lhs.multiply(rhs, alpha, addend, beta);
+        if(!lhs.compressed)
+            newMatrix.thaw();
+        return newMatrix;
+    }
+    
+    template <class E, class R>
+    static BasicSparseMatrix fusedProduct(const MatrixProduct<MatrixScaled<E>, R> &product, T alpha, const BasicSparseMatrix *addend, T beta){
+        return fusedProduct(MatrixProduct<E, R>(product.lhs.operand, product.rhs), alpha * product.lhs.alpha, addend, beta);
+    }
+    
+    template <class E>
+    static BasicSparseMatrix fusedProduct(const MatrixScaled<E> &scaled, T alpha, const BasicSparseMatrix *addend, T beta){
+        return fusedProduct(scaled.operand, alpha * scaled.alpha, addend, beta);
+    }
+    
+    /*
+    Post: return alpha*lhs + beta*rhs. When either side is a product the other side is accumulated into it;
+          otherwise the two are merged row by row.
+    */
+    template <class L, class R, class RhsIsProduct>
+    static BasicSparseMatrix sumOf(const L &lhs, T alpha, const R &rhs, T beta, true_type, RhsIsProduct){
+        BasicSparseMatrix rhsValue;
+        return fusedProduct(lhs, alpha, &evaluated(rhs, rhsValue), beta);
+    }
+    
+    template <class L, class R>
+    static BasicSparseMatrix sumOf(const L &lhs, T alpha, const R &rhs, T beta, false_type, true_type){
+        BasicSparseMatrix lhsValue;
+        return fusedProduct(rhs, beta, &evaluated(lhs, lhsValue), alpha);
+    }
+    
+    template <class L, class R>
+    static BasicSparseMatrix sumOf(const L &lhs, T alpha, const R &rhs, T beta, false_type, false_type){
+        BasicSparseMatrix lhsValue, rhsValue;
+        const BasicSparseMatrix &left = evaluated(lhs, lhsValue);
+        const BasicSparseMatrix &right = evaluated(rhs, rhsValue);
+        if(left.compressed)
+            return left.mergedWith(right, alpha, beta);
+        
+        BasicSparseMatrix newMatrix;
+        if(&left == &lhsValue)
+            newMatrix = move(lhsValue);
+        else
+            newMatrix = left;
+        if(alpha != 1)
+            newMatrix *= alpha;
+        newMatrix.axpy(beta, right);
+        return newMatrix;
+    }
+    
+    /*
+    Post: returns alpha*expression, scaling a product while it is accumulated.
+    */
+    template <class E>
+    static BasicSparseMatrix scaledBy(const E &expression, T alpha, true_type){
+        return fusedProduct(expression, alpha, nullptr, 0);
+    }
+    
+    template <class E>
+    static BasicSparseMatrix scaledBy(const E &expression, T alpha, false_type){
+        BasicSparseMatrix newMatrix = evaluate(expression);
+        newMatrix *= alpha;
+        return newMatrix;
+    }
+    
+    /*
+    Post: returns the transpose of expression. The transpose of a product is computed as rhs.tr() * lhs.tr(),
+          transposing the operands, which are usually much smaller than the product, instead of the product.
+    */
+    static BasicSparseMatrix transposeOf(const BasicSparseMatrix &matrix){
+        return matrix.transposed();
+    }
+    
+    template <class E>
+    static BasicSparseMatrix transposeOf(const E &expression){
+        return evaluate(expression).transposed();
+    }
+    
+    template <class E>
+    static BasicSparseMatrix transposeOf(const MatrixTranspose<E> &transpose){
+        return evaluate(transpose.operand);
+    }
+    
+    template <class L, class R>
+    static BasicSparseMatrix transposeOf(const MatrixProduct<L, R> &product){
+        BasicSparseMatrix lhsValue, rhsValue;
+        const BasicSparseMatrix &lhs = evaluated(product.lhs, lhsValue);
+        const BasicSparseMatrix &rhs = evaluated(product.rhs, rhsValue);
+        BasicSparseMatrix lhsTransposed(lhs.numCols, lhs.numRows, lhs.compressColumns(), lhs.pool);
+        BasicSparseMatrix rhsTransposed(rhs.numCols, rhs.numRows, rhs.compressColumns(), lhs.pool); //The product follows lhs
+        BasicSparseMatrix newMatrix = rhsTransposed.multiply(lhsTransposed, 1, nullptr, 0);
+        if(!lhs.compressed)
+            newMatrix.thaw();
+        return newMatrix;
+    }
+
+    
+    /*
+    Pre:  the matrix is frozen.
+    Post: returns the dot product of a row with the dense vector x, gathered with SIMD (see RowDotKernel).
+    */
+    T csrRowDot(Index row, const T *x) const {
+        size_t start = csr.offsets[row];
+        return RowDotKernel<T>::dot(csr.indices.data() + start, csr.values.data() + start, csr.offsets[row+1] - start, x);
+    }
+    
+    
+    /*
+    The first 64 bytes of a file written by writeBinary. The byte order mark and type sizes make a file
+    written on an incompatible machine fail to open rather than be misread.
+    */
+    struct BinaryHeader {
+        char magic[8];
+        uint32_t byteOrder;
+        uint16_t version;
+        uint16_t valueType;   //See valueTypeCode
+        uint16_t offsetBytes;
+        uint16_t indexBytes;
+        uint16_t valueBytes;
+        uint16_t reserved;
+        uint64_t numRows;
+        uint64_t numCols;
+        uint64_t nonZeros;
+        uint64_t indicesStart; //The offsets array starts right after the header
+        uint64_t valuesStart;
+    };
+    
+    /*
+    Post: returns the header of a binary file holding a matrix of the given size, with each array's start
+          rounded up to a multiple of 64 bytes.
+    */
+    static BinaryHeader binaryHeader(uint64_t n, uint64_t m, uint64_t nnz){
+        BinaryHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "SPARSEMX", 8);
+        header.byteOrder = 0x01020304;
+        header.version = 1;
+        header.valueType = valueTypeCode();
+        header.offsetBytes = sizeof(size_t);
+        header.indexBytes = sizeof(Index);
+        header.valueBytes = sizeof(T);
+        header.numRows = n;
+        header.numCols = m;
+        header.nonZeros = nnz;
+        header.indicesStart = alignTo64(sizeof(BinaryHeader) + (n + 1) * sizeof(size_t));
+        header.valuesStart = alignTo64(header.indicesStart + nnz * sizeof(Index));
+        return header;
+    }
+    
+    /*
+    Post: returns the number a binary file uses for the value type: 1 double, 2 float, 3-6 signed integers
+          of 1, 2, 4 and 8 bytes, 7-10 unsigned integers of 1, 2, 4 and 8 bytes, and 0 for anything else.
+    */
+    static uint16_t valueTypeCode(){
+        if(is_floating_point<T>::value)
+            return sizeof(T) == sizeof(double) ? 1 : sizeof(T) == sizeof(float) ? 2 : 0;
+        if(!is_integral<T>::value)
+            return 0;
+        uint16_t code = is_signed<T>::value ? 3 : 7;
+        for(size_t bytes = 1; bytes < sizeof(T) && bytes < 8; bytes *= 2){
+            code++;
+        }
+        return code;
+    }
+    
+    /*
+    Post: returns true if value is not negative and fits in Index.
+    */
+    template <class Integer>
+    static bool fitsIndex(Integer value){
+        return value >= 0 && (unsigned long long)value <= (unsigned long long)numeric_limits<Index>::max();
+    }
+    
+    static uint64_t alignTo64(uint64_t position){
+        return (position + 63) / 64 * 64;
+    }
+    
+    /*
+    Writes zero bytes until written reaches position.
+    Post: returns true if every byte was written.
+    */
+    static bool writePadding(FILE *file, size_t &written, uint64_t position){
+        bool ok = true;
+        for(; written < position && ok; written++){
+            ok = fputc(0, file) != EOF;
+        }
+        return ok;
+    }
+    
+    
+    /*
+    Post: returns the first character at or after ptr which is not a space, tab or line break.
+    */
+    static const char * skipBlank(const char *ptr, const char *end){
+        while(ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')){
+            ptr++;
+        }
+        return ptr;
+    }
+    
+    /*
+    Parses an integer after any leading blanks into value.
+    Post: returns the character after the integer, or nullptr if none was found (or ptr was already nullptr).
+    */
+    static const char * parseInteger(const char *ptr, const char *end, long long &value){
+        if(ptr == nullptr)
+            return nullptr;
+        ptr = skipBlank(ptr, end);
+        bool negative = ptr < end && *ptr == '-';
+        ptr += ptr < end && (*ptr == '-' || *ptr == '+');
+        if(ptr == end || *ptr < '0' || *ptr > '9')
+            return nullptr;
+        
+        value = 0;
+        for(; ptr < end && *ptr >= '0' && *ptr <= '9'; ptr++){
+            value = value * 10 + (*ptr - '0');
+        }
+        if(negative)
+            value = -value;
+        return ptr;
+    }
+    
+    /*
+    Parses a real number after any leading blanks into value. Numbers with at most 15 significant digits
+    and a small exponent are converted exactly with one multiply or divide by a power of ten; anything
+    else (long mantissas, huge exponents, inf or nan) goes through strtod.
+    Post: returns the character after the number, or nullptr if none was found (or ptr was already nullptr).
+    */
+    static const char * parseReal(const char *ptr, const char *end, double &value){
+        static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                             1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        if(ptr == nullptr)
+            return nullptr;
+        ptr = skipBlank(ptr, end);
+        const char *start = ptr;
+        
+        bool negative = ptr < end && *ptr == '-';
+        ptr += ptr < end && (*ptr == '-' || *ptr == '+');
+        unsigned long long mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool anyDigits = false;
+        for(; ptr < end && *ptr >= '0' && *ptr <= '9'; ptr++){
+            anyDigits = true;
+            if(mantissa == 0 && *ptr == '0')
+                continue; //Leading zeros are not significant
+            if(digits < 19)
+                mantissa = mantissa * 10 + (*ptr - '0');
+            else
+                exponent++;
+            digits++;
+        }
+        if(ptr < end && *ptr == '.'){
+            for(ptr++; ptr < end && *ptr >= '0' && *ptr <= '9'; ptr++){
+                anyDigits = true;
+                if(mantissa == 0 && *ptr == '0'){
+                    exponent--;
+                    continue;
+                }
+                if(digits < 19){
+                    mantissa = mantissa * 10 + (*ptr - '0');
+                    exponent--;
+                }
+                digits++;
+            }
+        }
+        if(anyDigits && ptr + 1 < end && (*ptr == 'e' || *ptr == 'E') && (isdigit(ptr[1]) || ptr[1] == '-' || ptr[1] == '+')){
+            long long power;
+            ptr = parseInteger(ptr + 1, end, power);
+            if(ptr == nullptr)
+                return nullptr;
+            exponent += (int)max(-100000LL, min(100000LL, power));
+        }
+        
+        if(anyDigits && digits <= 15 && exponent >= -22 && exponent <= 22){
+            value = exponent < 0 ? (double)mantissa / powersOfTen[-exponent] : (double)mantissa * powersOfTen[exponent];
+            if(negative)
+                value = -value;
+            return ptr;
+        }
+        
+        //Slow path: strtod needs a terminated copy of the token
+        char token[128];
+        size_t length = 0;
+        for(const char *c = start; c < end && length + 1 < sizeof(token) && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r'; c++){
+            token[length++] = *c;
+        }
+        token[length] = '\0';
+        char *parsedEnd;
+        value = strtod(token, &parsedEnd);
+        if(parsedEnd == token)
+            return nullptr;
+        return start + (parsedEnd - token);
+    }
+    
+    
+    /*
+    Calls f(col, value) for every Element of the row in column order, whether the matrix is frozen or not.
+    */
+    template <class Function>
+    void forEachInRow(Index row, Function f) const {
+        if(compressed){
+            for(size_t i = csr.offsets[row]; i < csr.offsets[row+1]; i++){
+                f(csr.indices[i], csr.values[i]);
+            }
+        }
+        else{
+            const ElementList &list = rows[row];
+            for(Element *ptr = list.getList(); ptr != nullptr; ptr = ptr->next){
+                f(ptr->col, ptr->value);
+            }
+        }
+    }
+};
+
+/*
+Prints out a SparseMatrix
+Post: prints the values stored in the SparseMatrix matrix.
+*/
+template <class T, class Index>
+ostream &operator << (ostream &out, const BasicSparseMatrix<T, Index> &matrix){
+    for(Index i=0; i < matrix.numRows; i++){
+        out << matrix[i];
+        if(i+1 < matrix.numRows)//Don't print a newline after the whole sparsematrix
+            out << endl;
+    }
+    return out;
+}
+
+
+
+
+
+//MARK: BlockSparseMatrix
+/*
+A matrix stored as fixed size R x C dense blocks in block compressed sparse row (BSR) form. The blocks
+of block row i are at positions offsets[i] .. offsets[i+1]-1, blockCols holds each block's column counted
+in blocks, and values holds the R*C values of each block column by column. Keeping one index per block
+instead of one per Element saves memory on matrices whose nonzeros come in small dense blocks, such as
+FEM matrices with several unknowns per node, and lets the BlockKernel work on whole blocks with SIMD.
+A matrix whose size is not a multiple of the block size is padded with zeros in its last block row and
+column. The blocks are not edited in place: build the matrix from a SparseMatrix and convert it back
+with toSparseMatrix().
+*/
+template <class T, class Index, int R, int C>
+class BasicBlockSparseMatrix {
+public:
+    typedef BasicSparseMatrix<T, Index> Matrix;
+    typedef BlockKernel<T, R, C> Kernel;
+    
+/* ---Constructors and Destructors--- */
+    BasicBlockSparseMatrix(Index n=0, Index m=0){ //An n x m matrix without any blocks
+        numRows = n;
+        numCols = m;
+        numBlockRows = (n + R - 1) / R;
+        numBlockCols = (m + C - 1) / C;
+        offsets.assign(numBlockRows + 1, 0);
+    }
+    
+    /*
+    Converts matrix, frozen or not, by grouping its Elements into the blocks they fall in. Only blocks
+    holding at least one Element are stored, and their other values are zero.
+    */
+    explicit BasicBlockSparseMatrix(const Matrix &matrix) : BasicBlockSparseMatrix(matrix.numRows, matrix.numCols) {
+        vector<Index> marker(numBlockCols, -1); //The last block row which used each block column
+        vector<size_t> position(numBlockCols);
+        vector<Index> touched;
+        for(Index blockRow=0; blockRow < numBlockRows; blockRow++){
+            Index firstRow = blockRow * R;
+            Index lastRow = min(numRows, firstRow + R);
+            touched.clear();
+            for(Index row = firstRow; row < lastRow; row++){
+                matrix.forEachInRow(row, [&](Index col, T){
+                    if(marker[col / C] != blockRow){
+                        marker[col / C] = blockRow;
+                        touched.push_back(col / C);
+                    }
+                });
+            }
+            sort(touched.begin(), touched.end());
+            
+            size_t first = blockCols.size();
+            for(size_t i=0; i < touched.size(); i++){
+                position[touched[i]] = first + i;
+                blockCols.push_back(touched[i]);
+            }
+            values.resize(blockCols.size() * R * C, T(0));
+            for(Index row = firstRow; row < lastRow; row++){
+                matrix.forEachInRow(row, [&](Index col, T value){
+                    values[position[col / C] * R * C + (col % C) * R + (row - firstRow)] = value;
+                });
+            }
+            offsets[blockRow + 1] = blockCols.size();
+        }
+    }
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Post: returns the matrix as a frozen SparseMatrix holding the nonzero values of the blocks.
+    */
+    Matrix toSparseMatrix() const {
+        typename Matrix::CompressedStorage storage;
+        storage.offsets.assign(numRows + 1, 0);
+        vector<Index> cols;
+        vector<T> rowValues;
+        for(Index row=0; row < numRows; row++){
+            Index blockRow = row / R;
+            for(size_t block = offsets[blockRow]; block < offsets[blockRow + 1]; block++){
+                for(int c=0; c < C; c++){
+                    Index col = blockCols[block] * C + c;
+                    T value = values[block * R * C + c * R + row % R];
+                    if(col < numCols && value != 0){
+                        cols.push_back(col);
+                        rowValues.push_back(value);
+                    }
+                }
+            }
+            storage.offsets[row + 1] = cols.size();
+        }
+        storage.indices.assign(move(cols));
+        storage.values.assign(move(rowValues));
+        return Matrix(numRows, numCols, move(storage));
+    }
+    
+    
+    /*
+    Pre:  row and col must be within the matrix's range
+    Post: returns the value at (row,col), or zero if no block is stored there. The block row is binary searched.
+    */
+    T at(Index row, Index col) const {
+        const Index *first = blockCols.data() + offsets[row / R];
+        const Index *last = blockCols.data() + offsets[row / R + 1];
+        const Index *ptr = lower_bound(first, last, col / C);
+        if(ptr == last || *ptr != col / C)
+            return 0;
+        return values[(ptr - blockCols.data()) * R * C + (col % C) * R + row % R];
+    }
+    
+    
+    /*
+    Post: returns the number of blocks stored.
+    */
+    size_t numBlocks() const {
+        return blockCols.size();
+    }
+    
+    
+    /*
+    Post: returns the number of nonzero values held in the blocks.
+    */
+    size_t nonZeros() const {
+        size_t nnz = 0;
+        for(size_t i=0; i < values.size(); i++){
+            if(values[i] != 0)
+                nnz++;
+        }
+        return nnz;
+    }
+    
+    
+    /*
+    Sparse matrix-vector multiply: y = alpha*self*x + beta*y. Each block row sums its blocks into R running
+    totals with the BlockKernel, and block rows are split over the WorkerPool in parts holding about the
+    same number of blocks. When beta is zero y is only written, never read.
+    Pre:  x holds numCols values and y holds numRows values, and the two do not overlap.
+    Post: y holds the result.
+    */
+    void spmv(T *y, const T *x, T alpha=1, T beta=0) const {
+        WorkerPool &pool = WorkerPool::shared();
+        int numParts = values.size() < Matrix::parallelThreshold ? 1 : (int)pool.size() * 4;
+        vector<Index> parts = Matrix::partitionByPrefix(offsets.data(), numBlockRows, numParts);
+        
+        pool.run(numParts, [&](int part){
+            T sums[R];
+            T padded[C];
+            for(Index blockRow = parts[part]; blockRow < parts[part+1]; blockRow++){
+                fill(sums, sums + R, T(0));
+                for(size_t block = offsets[blockRow]; block < offsets[blockRow + 1]; block++){
+                    const T *xBlock = x + (size_t)blockCols[block] * C;
+                    if(blockCols[block] == numBlockCols - 1 && numCols % C != 0){ //The last block column reaches past the end of x
+                        for(int c=0; c < C; c++){
+                            padded[c] = c < numCols % C ? xBlock[c] : T(0);
+                        }
+                        xBlock = padded;
+                    }
+                    Kernel::multiplyAdd(values.data() + block * R * C, xBlock, sums);
+                }
+                for(int r=0; r < R && blockRow * R + r < numRows; r++){
+                    Index row = blockRow * R + r;
+                    y[row] = alpha * sums[r] + (beta == 0 ? T(0) : beta * y[row]);
+                }
+            }
+        });
+    }
+    
+/* ---Operators--- */
+    
+    /*
+    Multiplies two block matrices with Gustavson's method over blocks: every block A(i,k) times every
+    block B(k,j) is added into a dense R x P accumulator block for output block j, using the BlockKernel.
+    Block rows are split over the WorkerPool in parts of about equal estimated cost. Output blocks which
+    come out all zero are not stored.
+    Pre:  rhs numRows must be the exact same as the lhs numCols.
+    Post: returns self * rhs, in blocks of R x P
+    */
+    template <int P>
+    BasicBlockSparseMatrix<T, Index, R, P> operator * (const BasicBlockSparseMatrix<T, Index, C, P> &rhs) const {
+        BasicBlockSparseMatrix<T, Index, R, P> product(numRows, rhs.numCols);
+        Index p = rhs.numBlockCols;
+        
+        //A block row's cost is one plus the number of blocks of rhs it reads
+        vector<size_t> cost(numBlockRows + 1, 0);
+        for(Index blockRow=0; blockRow < numBlockRows; blockRow++){
+            size_t work = 1;
+            for(size_t block = offsets[blockRow]; block < offsets[blockRow + 1]; block++){
+                work += rhs.offsets[blockCols[block] + 1] - rhs.offsets[blockCols[block]];
+            }
+            cost[blockRow + 1] = cost[blockRow] + work;
+        }
+        WorkerPool &pool = WorkerPool::shared();
+        int numParts = cost[numBlockRows] * R * C * P < Matrix::parallelThreshold ? 1 : (int)pool.size() * 4;
+        vector<Index> parts = Matrix::partitionByPrefix(cost.data(), numBlockRows, numParts);
+        
+        vector<vector<Index> > partCols(numParts);
+        vector<vector<T> > partValues(numParts);
+        pool.run(numParts, [&](int part){
+            if(parts[part] == parts[part+1])
+                return;
+            //Sparse accumulator over the output's block columns, as in SparseMatrix's multiply
+            vector<T> accumulator((size_t)p * R * P);
+            vector<Index> marker(p, -1);
+            vector<Index> touched(p);
+            for(Index blockRow = parts[part]; blockRow < parts[part+1]; blockRow++){
+                Index numTouched = 0;
+                for(size_t block = offsets[blockRow]; block < offsets[blockRow + 1]; block++){
+                    const T *lhs = values.data() + block * R * C;
+                    Index k = blockCols[block];
+                    for(size_t rhsBlock = rhs.offsets[k]; rhsBlock < rhs.offsets[k+1]; rhsBlock++){
+                        Index col = rhs.blockCols[rhsBlock];
+                        T *out = accumulator.data() + (size_t)col * R * P;
+                        if(marker[col] != blockRow){ //First contribution to this block in the current block row
+                            marker[col] = blockRow;
+                            fill(out, out + R * P, T(0));
+                            touched[numTouched++] = col;
+                        }
+                        Kernel::template multiplyAddBlock<P>(lhs, rhs.values.data() + rhsBlock * C * P, out);
+                    }
+                }
+                
+                sort(touched.begin(), touched.begin() + numTouched);
+                for(Index i=0; i < numTouched; i++){
+                    const T *out = accumulator.data() + (size_t)touched[i] * R * P;
+                    if(all_of(out, out + R * P, [](T value){ return value == 0; }))
+                        continue;
+                    partCols[part].push_back(touched[i]);
+                    partValues[part].insert(partValues[part].end(), out, out + R * P);
+                }
+                product.offsets[blockRow + 1] = partCols[part].size(); //Relative to the part for now
+            }
+        });
+        
+        //Parts hold consecutive block rows, so joining them in order gives the arrays
+        for(int part=0; part < numParts; part++){
+            size_t base = product.blockCols.size();
+            for(Index blockRow = parts[part]; blockRow < parts[part+1]; blockRow++){
+                product.offsets[blockRow + 1] += base;
+            }
+            product.blockCols.insert(product.blockCols.end(), partCols[part].begin(), partCols[part].end());
+            product.values.insert(product.values.end(), partValues[part].begin(), partValues[part].end());
+        }
+        return product;
+    }
+    
+    
+    /* Friends */
+    template <class U, class I, int R2, int C2> friend class BasicBlockSparseMatrix;
+    template <class U, class I> friend class BasicSparseMatrix;
+private:
+    Index numRows;
+    Index numCols;
+    Index numBlockRows;
+    Index numBlockCols;
+    
+    vector<size_t> offsets;
+    vector<Index> blockCols;
+    vector<T> values;
+};
+
+
+//MARK: SellMatrix
+/*
+A matrix stored in sliced ELLPACK form with sorting (SELL-C-sigma), laid out for SIMD matrix-vector
+multiplies. Rows are sorted by length, longest first, within windows of sigma consecutive rows, and the
+sorted rows are cut into chunks of C. A chunk is stored column by column, padded to the length of its
+longest row: slot j of the chunk's row r is at chunkOffsets[chunk] + j*C + r in cols and values. spmv
+then works down C rows at once with whole lanes of values and gathered values of x, and sorting keeps
+the rows sharing a chunk about the same length so little of it is padding. rowOrder maps a sorted
+position back to the row of the original matrix it holds.
+
+A larger sigma gives less padding but scatters the results further through y; sigma = 1 keeps the
+original row order. Padding slots hold zero and read x at the last column of their row. Like a
+BlockSparseMatrix, it is built from a SparseMatrix and converted back with toSparseMatrix().
+*/
+template <class T, class Index, int C>
+class BasicSellMatrix {
+public:
+    typedef BasicSparseMatrix<T, Index> Matrix;
+    typedef typename BlockLane<T, C>::type Lane;
+    typedef typename Lane::Vector Vector;
+    
+/* ---Constructors and Destructors--- */
+    BasicSellMatrix(Index n=0, Index m=0){ //An n x m matrix without any Elements
+        numRows = n;
+        numCols = m;
+        numChunks = (n + C - 1) / C;
+        chunkOffsets.assign(numChunks + 1, 0);
+        rowOrder.resize(n);
+        for(Index row=0; row < n; row++){
+            rowOrder[row] = row;
+        }
+    }
+    
+    /*
+    Converts matrix, frozen or not, sorting its rows by length within windows of sigma rows.
+    Pre:  sigma is at least 1.
+    */
+    explicit BasicSellMatrix(const Matrix &matrix, Index sigma=16 * C) : BasicSellMatrix(matrix.numRows, matrix.numCols) {
+        vector<Index> length(numRows, 0);
+        for(Index row=0; row < numRows; row++){
+            matrix.forEachInRow(row, [&](Index, T){ length[row]++; });
+        }
+        for(Index first=0; first < numRows; first += sigma){
+            Index last = numRows - first > sigma ? first + sigma : numRows;
+            stable_sort(rowOrder.begin() + first, rowOrder.begin() + last, [&](Index a, Index b){
+                return length[a] > length[b];
+            });
+        }
+        
+        for(Index chunk=0; chunk < numChunks; chunk++){
+            Index width = 0;
+            for(Index position = chunk * C; position < numRows && position < (chunk + 1) * C; position++){
+                width = max(width, length[rowOrder[position]]);
+            }
+            chunkOffsets[chunk + 1] = chunkOffsets[chunk] + (size_t)width * C;
+        }
+        cols.assign(chunkOffsets[numChunks], 0);
+        values.assign(chunkOffsets[numChunks], T(0));
+        for(Index position=0; position < numRows; position++){
+            size_t slot = chunkOffsets[position / C] + position % C;
+            size_t end = chunkOffsets[position / C + 1];
+            Index lastCol = 0;
+            matrix.forEachInRow(rowOrder[position], [&](Index col, T value){
+                cols[slot] = lastCol = col;
+                values[slot] = value;
+                slot += C;
+            });
+            for(; slot < end; slot += C){
+                cols[slot] = lastCol;
+            }
+        }
+    }
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Post: returns the matrix as a frozen SparseMatrix holding the nonzero values of the rows.
+    */
+    Matrix toSparseMatrix() const {
+        vector<Index> position(numRows);
+        for(Index i=0; i < numRows; i++){
+            position[rowOrder[i]] = i;
+        }
+        typename Matrix::CompressedStorage storage;
+        storage.offsets.assign(numRows + 1, 0);
+        vector<Index> rowCols;
+        vector<T> rowValues;
+        for(Index row=0; row < numRows; row++){
+            Index chunk = position[row] / C;
+            for(size_t slot = chunkOffsets[chunk] + position[row] % C; slot < chunkOffsets[chunk + 1]; slot += C){
+                if(values[slot] != 0){
+                    rowCols.push_back(cols[slot]);
+                    rowValues.push_back(values[slot]);
+                }
+            }
+            storage.offsets[row + 1] = rowCols.size();
+        }
+        storage.indices.assign(move(rowCols));
+        storage.values.assign(move(rowValues));
+        return Matrix(numRows, numCols, move(storage));
+    }
+    
+    
+    /*
+    Post: returns the original row held at each sorted position.
+    */
+    const vector<Index> & permutation() const {
+        return rowOrder;
+    }
+    
+    
+    /*
+    Post: returns the number of slots stored, padding included.
+    */
+    size_t slots() const {
+        return values.size();
+    }
+    
+    
+    /*
+    Post: returns the number of nonzero values stored.
+    */
+    size_t nonZeros() const {
+        return values.size() - count(values.begin(), values.end(), T(0));
+    }
+    
+    
+    /*
+    Sparse matrix-vector multiply: y = alpha*self*x + beta*y. Each chunk is summed C rows at a time, a lane
+    of rows per vector register, and the sums are written to the original rows through rowOrder. Chunks are
+    split over the WorkerPool in parts holding about the same number of slots. When beta is zero y is only
+    written, never read.
+    Pre:  x holds numCols values and y holds numRows values, and the two do not overlap.
+    Post: y holds the result.
+    */
+    void spmv(T *y, const T *x, T alpha=1, T beta=0) const {
+        WorkerPool &pool = WorkerPool::shared();
+        int numParts = values.size() < Matrix::parallelThreshold ? 1 : (int)pool.size() * 4;
+        vector<Index> parts = Matrix::partitionByPrefix(chunkOffsets.data(), numChunks, numParts);
+        
+        pool.run(numParts, [&](int part){
+            T sums[C];
+            for(Index chunk = parts[part]; chunk < parts[part+1]; chunk++){
+                size_t first = chunkOffsets[chunk];
+                size_t end = chunkOffsets[chunk + 1];
+                for(int r=0; r < C; r += Lane::width){
+                    Vector sum = Lane::broadcast(T(0));
+                    for(size_t slot = first + r; slot < end; slot += C){
+                        sum = Lane::multiplyAdd(Lane::load(values.data() + slot), Lane::gather(x, cols.data() + slot), sum);
+                    }
+                    Lane::store(sums + r, sum);
+                }
+                for(int r=0; r < C && chunk * C + r < numRows; r++){
+                    Index row = rowOrder[chunk * C + r];
+                    y[row] = alpha * sums[r] + (beta == 0 ? T(0) : beta * y[row]);
+                }
+            }
+        });
+    }
+    
+private:
+    Index numRows;
+    Index numCols;
+    Index numChunks;
+    
+    vector<Index> rowOrder;
+    vector<size_t> chunkOffsets;
+    vector<Index> cols;
+    vector<T> values;
+};
+
+
+//MARK: MultiplyPlan
+/*
+The symbolic part of a product a*b, worked out once so that products of matrices with the same patterns
+as a and b but other values, as iterative methods compute over and over, only redo the arithmetic. The
+plan holds the pattern of the product in compressed row form and a scatter map: for every multiplication
+a(i,k)*b(k,j), in the order the rows of a and b are walked, the position of column j within row i of the
+product. execute() then walks a and b once and adds each product straight into its place, without an
+accumulator, sorting or any allocation.
+
+execute() does not change the plan, so several threads may run one plan at once on different matrices;
+their turns on the shared WorkerPool are taken one after another. The product keeps the planned pattern,
+so values which cancel out stay stored as zeros.
+*/
+template <class T, class Index>
+class BasicMultiplyPlan {
+public:
+    typedef BasicSparseMatrix<T, Index> Matrix;
+    typedef BasicCompressedStorage<T, Index> CompressedStorage;
+    
+/* ---Constructors and Destructors--- */
+    BasicMultiplyPlan(){ //A plan for the product of two 0x0 matrices
+        numRows = numInner = numCols = 0;
+        lhsNonZeros = rhsNonZeros = 0;
+        parts.assign(2, 0);
+        partScatter.assign(2, 0);
+        offsets.assign(1, 0);
+    }
+    
+    /*
+    Runs the symbolic phase of a*b: the pattern of every row of the product and where each multiplication
+    goes in it. Rows are split over the WorkerPool in parts of about equal cost, as in a multiply, and
+    execute() keeps the same parts. Either matrix may be frozen.
+    Pre:  b numRows must be the exact same as a numCols.
+    */
+    BasicMultiplyPlan(const Matrix &a, const Matrix &b){
+        numRows = a.numRows;
+        numInner = a.numCols;
+        numCols = b.numCols;
+        lhsNonZeros = a.nonZeros();
+        rhsNonZeros = b.nonZeros();
+        vector<size_t> cost = a.productCosts(b, nullptr);
+        WorkerPool &pool = WorkerPool::shared();
+        int numParts = cost[numRows] < Matrix::parallelThreshold ? 1 : (int)pool.size() * 4;
+        parts = Matrix::partitionByPrefix(cost.data(), numRows, numParts);
+        
+        vector<vector<Index> > partCols(numParts);
+        vector<vector<Index> > partPositions(numParts);
+        vector<size_t> rowLength(numRows);
+        pool.run(numParts, [&](int part){
+            if(parts[part] == parts[part+1])
+                return;
+            vector<Index> marker(numCols, -1); //The last row which touched each column
+            vector<Index> position(numCols);   //Where that column is within the row
+            vector<Index> touched;
+            for(Index row = parts[part]; row < parts[part+1]; row++){
+                touched.clear();
+                a.forEachInRow(row, [&](Index k, T){
+                    b.forEachInRow(k, [&](Index col, T){
+                        if(marker[col] != row){
+                            marker[col] = row;
+                            touched.push_back(col);
+                        }
+                    });
+                });
+                sort(touched.begin(), touched.end());
+                for(size_t i=0; i < touched.size(); i++){
+                    position[touched[i]] = (Index)i;
+                }
+                partCols[part].insert(partCols[part].end(), touched.begin(), touched.end());
+                a.forEachInRow(row, [&](Index k, T){
+                    b.forEachInRow(k, [&](Index col, T){ partPositions[part].push_back(position[col]); });
+                });
+                rowLength[row] = touched.size();
+            }
+        });
+        
+        offsets.assign(numRows + 1, 0);
+        for(Index row=0; row < numRows; row++){
+            offsets[row+1] = offsets[row] + rowLength[row];
+        }
+        partScatter.assign(numParts + 1, 0);
+        for(int part=0; part < numParts; part++){ //Parts hold consecutive rows, so joining them in order gives the arrays
+            cols.insert(cols.end(), partCols[part].begin(), partCols[part].end());
+            scatter.insert(scatter.end(), partPositions[part].begin(), partPositions[part].end());
+            partScatter[part+1] = scatter.size();
+        }
+    }
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Post: returns a frozen matrix with the pattern of the product and every value zero, to be filled by execute().
+    */
+    Matrix newProduct() const {
+        CompressedStorage storage;
+        storage.offsets.assign(vector<size_t>(offsets));
+        storage.indices.assign(vector<Index>(cols));
+        storage.values.assign(vector<T>(cols.size(), T(0)));
+        return Matrix(numRows, numCols, move(storage));
+    }
+    
+    
+    /*
+    Checks that a and b could be the matrices the plan was made for. Only their sizes and numbers of Elements
+    are compared, not every column.
+    Post: returns true if a*b can be executed with the plan.
+    */
+    bool matches(const Matrix &a, const Matrix &b) const {
+        return a.numRows == numRows && a.numCols == numInner && b.numRows == numInner && b.numCols == numCols
+            && a.nonZeros() == lhsNonZeros && b.nonZeros() == rhsNonZeros;
+    }
+    
+    
+    /*
+    Post: returns the number of multiplications a product takes, which is the length of the scatter map.
+    */
+    size_t multiplications() const {
+        return scatter.size();
+    }
+    
+    
+    /*
+    Post: returns the number of Elements in the pattern of the product.
+    */
+    size_t nonZeros() const {
+        return cols.size();
+    }
+    
+    
+    /*
+    Computes the values of a*b into product, using the WorkerPool. Nothing is allocated unless product's values
+    are still a view of a mapped file, which are copied out first.
+    Pre:  a and b have the patterns the plan was made for (see matches), frozen or not, and product is a frozen
+          matrix with the pattern of the product, such as one returned by newProduct().
+    Post: product holds a*b.
+    */
+    void execute(const Matrix &a, const Matrix &b, Matrix &product) const {
+        if(product.csr.values.isView())
+            product.csr.values.resize(product.csr.size());
+        Execution run = {this, &a, &b, product.csr.values.data()};
+        const Execution *job = &run; //A single pointer fits inside the function object, which then needs no allocation
+        WorkerPool::shared().run((int)parts.size() - 1, [job](int part){ job->plan->executePart(part, *job->lhs, *job->rhs, job->values); });
+    }
+    
+private:
+    Index numRows;
+    Index numInner;
+    Index numCols;
+    size_t lhsNonZeros;
+    size_t rhsNonZeros;
+    
+    vector<Index> parts;        //Each part's rows are [parts[p], parts[p+1])
+    vector<size_t> partScatter; //Each part's multiplications start at scatter[partScatter[p]]
+    vector<size_t> offsets;     //Pattern of the product
+    vector<Index> cols;
+    vector<Index> scatter;      //Position within its row of the product of every multiplication
+    
+    struct Execution {
+        const BasicMultiplyPlan *plan;
+        const Matrix *lhs;
+        const Matrix *rhs;
+        T *values;
+    };
+    
+    /*
+    Post: the rows of one part of the product hold their values.
+    */
+    void executePart(int part, const Matrix &a, const Matrix &b, T *values) const {
+        const Index *position = scatter.data() + partScatter[part];
+        for(Index row = parts[part]; row < parts[part+1]; row++){
+            T *out = values + offsets[row];
+            fill(out, values + offsets[row+1], T(0));
+            a.forEachInRow(row, [&](Index k, T lhsVal){
+                b.forEachInRow(k, [&](Index, T rhsVal){ out[*position++] += lhsVal * rhsVal; });
+            });
+        }
+    }
+};
+
+
+//MARK: DeltaMatrix
+/*
+A matrix for a steady stream of random (row, col, value) updates. Writing through matrix[row][col] walks
+the row's list and allocates an Element for every new position; update() instead appends the triplet to
+a log, so a write costs about as much as a push_back. Each thread writes to a log of its own, picked by
+the order threads first wrote to any DeltaMatrix, so writers do not wait on one another.
+
+The logs are merged into the matrix, which is kept frozen, in sorted batches: once a log passes its share
+of the merge threshold, and whenever a read needs the current values. A merge sorts the batch into rows
+with fromTriplets and merges every row with the batch in one parallel pass, so its cost is spread over
+at least threshold updates. Updates to a position are combined by the DuplicatePolicy, both within a
+batch and with the value already stored.
+
+update() may be called from any number of threads at once. Reads (at, matrix, nonZeros) and merge() see
+every update which finished before them, but must not run while another thread updates. When two threads
+update the same position between merges, which value DuplicatePolicy::Last keeps is not defined.
+*/
+template <class T, class Index>
+class BasicDeltaMatrix {
+public:
+    typedef BasicSparseMatrix<T, Index> Matrix;
+    typedef BasicTriplet<T, Index> Triplet;
+    
+/* ---Constructors and Destructors--- */
+    /*
+    Pre:  threshold is the number of pending updates which starts a merge, or zero to use the larger of
+          65536 and the matrix's rows plus Elements, so a merge, which walks them all, costs a constant per update.
+    Post: an empty n x m matrix.
+    */
+    BasicDeltaMatrix(Index n=0, Index m=0, DuplicatePolicy policy=DuplicatePolicy::Last, size_t threshold=0)
+        : merged(n, m), policy(policy), threshold(threshold), dirty(false){
+        merged.freeze();
+        newLogs();
+    }
+    
+    /*
+    Post: a DeltaMatrix holding a frozen copy of matrix, with the same arguments as above.
+    */
+    explicit BasicDeltaMatrix(const Matrix &matrix, DuplicatePolicy policy=DuplicatePolicy::Last, size_t threshold=0)
+        : merged(matrix), policy(policy), threshold(threshold), dirty(false){
+        merged.freeze();
+        newLogs();
+    }
+    
+    BasicDeltaMatrix(const BasicDeltaMatrix &) = delete;
+    BasicDeltaMatrix & operator = (const BasicDeltaMatrix &) = delete;
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Records a write of value at (row,col), to be merged later. Safe to call from several threads at once.
+    Pre:  row and col must be within the matrix's range.
+    Post: the update is pending, or merged if it filled the thread's log.
+    */
+    void update(Index row, Index col, T value){
+        Log &log = *logs[threadSlot() % logs.size()];
+        size_t length;
+        {
+            lock_guard<mutex> guard(log.lock);
+            log.entries.push_back(Triplet(row, col, value));
+            length = log.entries.size();
+        }
+        if(!dirty.load(memory_order_relaxed))
+            dirty.store(true);
+        if(length >= logLimit.load(memory_order_relaxed)){
+            unique_lock<mutex> guard(mergeLock, try_to_lock); //A merge already running will take this log too
+            if(guard.owns_lock())
+                mergeLogs();
+        }
+    }
+    
+    
+    /*
+    Post: every pending update is merged into the matrix.
+    */
+    void merge(){
+        lock_guard<mutex> guard(mergeLock);
+        mergeLogs();
+    }
+    
+    
+    /*
+    Merges any pending updates first.
+    Post: returns the merged, frozen matrix, for reads, products, transposes and spmv. The reference stays
+          valid, but the next merge replaces its contents.
+    */
+    const Matrix & matrix(){
+        if(dirty.load())
+            merge();
+        return merged;
+    }
+    
+    
+    /*
+    Merges any pending updates first, like matrix().
+    Pre:  row and col must be within the matrix's range.
+    Post: returns the value at (row,col), or zero if no Element exists there.
+    */
+    T at(Index row, Index col){
+        return matrix().at(row, col);
+    }
+    
+    
+    /*
+    Post: returns the number of Elements stored once pending updates are merged.
+    */
+    size_t nonZeros(){
+        return matrix().nonZeros();
+    }
+    
+    
+    /*
+    Post: returns the number of updates waiting in the logs.
+    */
+    size_t pending() const {
+        size_t total = 0;
+        for(size_t i=0; i < logs.size(); i++){
+            lock_guard<mutex> guard(logs[i]->lock);
+            total += logs[i]->entries.size();
+        }
+        return total;
+    }
+    
+private:
+    struct Log {
+        mutex lock;
+        vector<Triplet> entries;
+        char padding[64]; //Keeps the locks of neighbouring logs off one cache line
+    };
+    
+    Matrix merged;
+    DuplicatePolicy policy;
+    size_t threshold;
+    vector<unique_ptr<Log> > logs;
+    atomic<size_t> logLimit; //Length of one log which starts a merge
+    atomic<bool> dirty;      //Set by updates, cleared when a merge starts
+    mutex mergeLock;
+    vector<Index> batchRows; //Kept between merges so their memory is reused
+    vector<Index> batchCols;
+    vector<T> batchValues;
+    
+    /*
+    Post: two logs for every hardware thread, so writers rarely share one, and the merge threshold set.
+    */
+    void newLogs(){
+        size_t count = max(1u, thread::hardware_concurrency()) * 2;
+        for(size_t i=0; i < count; i++){
+            logs.push_back(unique_ptr<Log>(new Log()));
+        }
+        setLogLimit();
+    }
+    
+    /*
+    Post: logLimit is the threshold's share for one log.
+    */
+    void setLogLimit(){
+        size_t total = threshold != 0 ? threshold : max((size_t)1 << 16, merged.nonZeros() + merged.numRows);
+        logLimit.store(max(total / logs.size(), (size_t)1));
+    }
+    
+    /*
+    Pre:  mergeLock is held.
+    Post: the contents of every log are merged into the matrix and the logs are empty.
+    */
+    void mergeLogs(){
+        dirty.store(false); //Before the logs are taken, so a later update sets it again
+        for(size_t i=0; i < logs.size(); i++){
+            Log &log = *logs[i];
+            lock_guard<mutex> guard(log.lock);
+            for(size_t e=0; e < log.entries.size(); e++){
+                batchRows.push_back(log.entries[e].row);
+                batchCols.push_back(log.entries[e].col);
+                batchValues.push_back(log.entries[e].value);
             }
+            log.entries.clear(); //Writers keep their log's memory
         }
-        return false;
+        if(batchValues.empty())
+            return;
+        
+        Matrix updates = Matrix::fromTriplets(merged.numRows, merged.numCols, batchRows.data(), batchCols.data(),
+                                              batchValues.data(), batchValues.size(), policy);
+        merged = merged.mergedUpdates(updates, policy);
+        batchRows.clear();
+        batchCols.clear();
+        batchValues.clear();
+        setLogLimit();
     }
     
     /*
-    Unit test for copying a sparsematrix with the = operator. Checks for sizes being set
-     correctly and that all values are the same after the = operator with no extra elements being added.
-    Post: returns true if the unit test passes, or false if it fails
+    Post: returns a number unique to the calling thread, counting up from zero in the order threads first
+          ask for one, so the first threads to write use different logs.
     */
-    bool sparseMatrixEqualsUnitTest(){
-        SparseMatrix a(2,3);
-        // 0 1 2
-        // 3 4 5
-        a[0][1] = 1;
-        a[0][2] = 2;
-        a[1][0] = 3;
-        a[1][1] = 4;
-        a[1][2] = 5;
+    static size_t threadSlot(){
+        static atomic<size_t> nextSlot(0);
+        static thread_local size_t slot = nextSlot++;
+        return slot;
+    }
+};
+
+
+//MARK: VersionedMatrix
+/*
+A matrix many threads can read while a writer changes it. Readers work on snapshots: snapshot() returns an
+immutable version of the whole matrix without taking a lock, and reads through it never see a later write,
+so every read made through one snapshot agrees with every other.
+
+Rows are stored compressed, 64 to a page, behind a root which holds the version's page pointers. Writes are
+staged with set() and erase() and made visible together by publish(), which copies each changed row, the
+pages holding them and the root, and swaps the new root in with one atomic store. Rows and pages which did
+not change are shared with the old version, so publishing costs the changed rows plus numRows/64 pointers.
+
+What the new version replaced is freed by epoch based reclamation. Each open snapshot announces the epoch
+it started in, in a slot of its own, and every publish moves the epoch on; replaced rows are freed once no
+snapshot older than their replacement is still open. A snapshot should therefore not be held for long, as
+it keeps everything replaced since it started alive. At most 64 snapshots (or four per hardware thread, if
+more) can be open at once; more wait for one to close.
+*/
+template <class T, class Index>
+class BasicVersionedMatrix {
+    struct Row;
+    struct Page;
+    struct Version;
+public:
+    typedef BasicSparseMatrix<T, Index> Matrix;
+    typedef BasicRowView<T, Index> RowView;
+    
+    /*
+    One version of the matrix, which stays readable and unchanged for as long as the Snapshot is alive.
+    A Snapshot can be moved but not copied, and is used by one thread at a time.
+    */
+    class Snapshot {
+    public:
+        Snapshot(Snapshot &&rhs) : owner(rhs.owner), slot(rhs.slot), current(rhs.current){
+            rhs.owner = nullptr;
+        }
         
-        SparseMatrix b = a;
+        Snapshot(const Snapshot &) = delete;
+        Snapshot & operator = (const Snapshot &) = delete;
         
-        if(b.numRows!=a.numRows || b.numCols!=a.numCols) //Test if sizes are the same
-            return false;
+        ~Snapshot(){
+            if(owner != nullptr)
+                owner->slots[slot]->epoch.store(0);
+        }
         
+        /*
+        Post: returns the number of publishes before this version, starting from 0.
+        */
+        uint64_t version() const {
+            return current->number;
+        }
         
-        for(int row=0; row<a.numRows; row++){//Test if same number of elements exist in both
-            Element *bRowHead = b[row].getList();
-            Element *aRowHead = a[row].getList();
-            
-            int bRowCount=0;
-            int aRowCount=0;
-            
-            while(bRowHead != nullptr){
-                bRowCount++;
-                bRowHead = bRowHead->next;
-            }
-            while(aRowHead != nullptr){
-                aRowCount++;
-                aRowHead = aRowHead->next;
-            }
-            
-            if(aRowCount != bRowCount)
-                return false;
+        /*
+        Pre:  row must be within the matrix's range.
+        Post: returns a view of the row, valid while the Snapshot is.
+        */
+        RowView row(Index row) const {
+            const Row *stored = current->pages[row / pageRows]->rows[row % pageRows];
+            if(stored == nullptr)
+                return RowView((const Index *)nullptr, (const T *)nullptr, 0, owner->numCols);
+            return RowView(stored->cols.data(), stored->values.data(), stored->cols.size(), owner->numCols);
         }
         
-        if(b[0][1]==1 && b[0][2]==2 && b[1][0]==3 && b[1][1]==4 && b[1][2]==5){//check if values are correct
-            //If here has been reached the matrix b has only the elements a has and in the correct locations.
-            return true;
+        /*
+        Pre:  row and col must be within the matrix's range.
+        Post: returns the value at (row,col), or zero if no Element exists there.
+        */
+        T at(Index row, Index col) const {
+            return this->row(row)[col];
         }
         
-        return false;
-    }
-    
-    /*
-    Unit test for transposing a sparsematrix. Checks if the transposed sparsematrix has its
-     transposed values in the correct places.
-    Post: returns true if the unit test passes, or false if it fails
-    */
-    bool sparseMatrixTransposeUnitTest(){
-        SparseMatrix a(3,5);
         /*
-        2 x 1 9 x
-        x x x x 4
-        x 7 x x x
+        Post: returns the number of Elements in this version.
         */
+        size_t nonZeros() const {
+            return current->nonZeros;
+        }
         
-        a[0][0] = 2;
-        a[0][2] = 1;
-        a[0][3] = 9;
-        a[1][4] = 4;
-        a[2][1] = 7;
+        /*
+        Post: returns a frozen copy of this version, for products, transposes and spmv.
+        */
+        Matrix toSparseMatrix() const {
+            return owner->copyOf(*current);
+        }
         
-        SparseMatrix b = a.tr();
-        if(b.numRows==a.numCols && b.numCols==a.numRows){//Unit test - first check if the sizes have been flipped
-            int numOfElementsA=0;
-            for(int row=0; row < a.numRows; row++){
-                Element *ptr = a.rows[row].getList(); //point to head of row
-                while(ptr != nullptr){
-                    numOfElementsA++;
-                    ptr = ptr->next;
-                }
-            }
-            
-            int numOfElementsB=0;
-            for(int row=0; row < b.numRows; row++){
-                Element *ptr = b.rows[row].getList();
-                while(ptr != nullptr){
-                    numOfElementsB++;
-                    ptr = ptr->next;
-                }
+    private:
+        const BasicVersionedMatrix *owner;
+        size_t slot;
+        const Version *current;
+        
+        Snapshot(const BasicVersionedMatrix *owner, size_t slot, const Version *current)
+            : owner(owner), slot(slot), current(current){}
+        
+        friend class BasicVersionedMatrix;
+    };
+    
+/* ---Constructors and Destructors--- */
+    /*
+    Post: an n x m matrix with no Elements, at version 0.
+    */
+    BasicVersionedMatrix(Index n=0, Index m=0) : numRows(n), numCols(m), epoch(1){
+        Version *first = new Version();
+        first->pages.resize((size_t)(n + pageRows - 1) / pageRows);
+        for(size_t p=0; p < first->pages.size(); p++){
+            first->pages[p] = new Page();
+        }
+        root.store(first);
+        newSlots();
+    }
+    
+    /*
+    Post: a copy of matrix, which may be frozen or not, at version 0.
+    */
+    explicit BasicVersionedMatrix(const Matrix &matrix) : BasicVersionedMatrix(matrix.numRows, matrix.numCols){
+        Version *first = const_cast<Version *>(root.load());
+        for(Index row=0; row < numRows; row++){
+            Row *stored = new Row();
+            matrix.forEachInRow(row, [&](Index col, T value){
+                stored->cols.push_back(col);
+                stored->values.push_back(value);
+            });
+            first->nonZeros += stored->cols.size();
+            first->pages[row / pageRows]->rows[row % pageRows] = stored;
+        }
+    }
+    
+    BasicVersionedMatrix(const BasicVersionedMatrix &) = delete;
+    BasicVersionedMatrix & operator = (const BasicVersionedMatrix &) = delete;
+    
+    /*
+    Pre:  no Snapshot of the matrix is still open.
+    */
+    ~BasicVersionedMatrix(){
+        for(size_t i=0; i < retired.size(); i++){
+            release(retired[i]);
+        }
+        const Version *last = root.load();
+        for(size_t p=0; p < last->pages.size(); p++){
+            for(int r=0; r < pageRows; r++){
+                delete last->pages[p]->rows[r];
             }
+            delete last->pages[p];
+        }
+        delete last;
+    }
+    
+/* ---Accessors and Mutators--- */
+    
+    /*
+    Takes a snapshot of the latest published version, without locking. Safe to call from any thread, also
+    while another thread publishes.
+    Post: returns the snapshot, which reads that version until it is destroyed.
+    */
+    Snapshot snapshot() const {
+        size_t count = slots.size();
+        size_t first = threadSlot() % count;
+        for(size_t tries=0; ; tries++){
+            size_t slot = (first + tries) % count;
+            uint64_t now = epoch.load();
+            uint64_t empty = 0;
+            if(slots[slot]->epoch.compare_exchange_strong(empty, now)) //Announced before the root is read
+                return Snapshot(this, slot, root.load());
+            if(tries % count == count - 1)
+                this_thread::yield(); //Every slot is taken, wait for a snapshot to close
+        }
+    }
+    
+    
+    /*
+    Stages a write of value at (row,col), seen by snapshots taken after the next publish(). Staged writes
+    to one position keep the last value.
+    Pre:  row and col must be within the matrix's range.
+    */
+    void set(Index row, Index col, T value){
+        lock_guard<mutex> guard(writeLock);
+        staged.push_back(Write(row, col, value, false));
+    }
+    
+    
+    /*
+    Stages the removal of the Element at (row,col), if there is one, like set().
+    Pre:  row and col must be within the matrix's range.
+    */
+    void erase(Index row, Index col){
+        lock_guard<mutex> guard(writeLock);
+        staged.push_back(Write(row, col, T(0), true));
+    }
+    
+    
+    /*
+    Makes every staged write visible at once as a new version, and frees what earlier versions replaced
+    if no snapshot can still read it. Publishes from several threads are taken one after another.
+    Post: returns the number of the latest version.
+    */
+    uint64_t publish(){
+        lock_guard<mutex> guard(writeLock);
+        const Version *old = root.load();
+        if(staged.empty())
+            return old->number;
+        stable_sort(staged.begin(), staged.end(), [](const Write &a, const Write &b){
+            return a.row < b.row || (a.row == b.row && a.col < b.col);
+        });
+        
+        Version *next = new Version(*old);
+        next->number = old->number + 1;
+        Retired replaced;
+        replaced.version = old;
+        for(size_t first=0, last; first < staged.size(); first = last){
+            Index row = staged[first].row;
+            for(last = first + 1; last < staged.size() && staged[last].row == row; last++);
             
-            //Unit test - Ensure matrices have same number of element
-            if(numOfElementsA != numOfElementsB){
-                return false;
+            Page *&page = next->pages[row / pageRows];
+            if(page == old->pages[row / pageRows]){ //First change to this page in this publish
+                replaced.pages.push_back(page);
+                page = new Page(*page);
             }
-            
-            //Unit test - Ensure that the matrices share the same values and positions
-            if(b[0][0]==2 && b[1][2]==7 && b[2][0]==1 && b[3][0]==9 && b[4][1]==4){//check if values are in the correct positions for matrix b
-                return true;
+            const Row *&stored = page->rows[row % pageRows];
+            Row *changed = updatedRow(stored, first, last);
+            if(stored != nullptr){
+                next->nonZeros -= stored->cols.size();
+                replaced.rows.push_back(stored);
             }
-            
+            next->nonZeros += changed->cols.size();
+            stored = changed;
         }
+        staged.clear();
         
-        return false;
+        root.store(next);
+        replaced.epoch = epoch.fetch_add(1); //Snapshots announcing a later epoch read the new root
+        retired.push_back(move(replaced));
+        reclaimLocked();
+        return next->number;
     }
     
     
-    /* Friends */
-    friend ostream &operator << (ostream &out, SparseMatrix matrix);
+    /*
+    Frees what earlier versions replaced and no open snapshot can read.
+    Post: returns the number of publishes whose replaced rows are still waiting for snapshots to close.
+    */
+    size_t reclaim(){
+        lock_guard<mutex> guard(writeLock);
+        reclaimLocked();
+        return retired.size();
+    }
+    
+    
+    /*
+    Post: returns the number of the latest published version.
+    */
+    uint64_t version() const {
+        return root.load()->number;
+    }
+    
 private:
-    int numRows;
-    int numCols;
+    static const int pageRows = 64;
     
-    ElementList *rows;
-};
-
-/*
-Prints out a SparseMatrix
-Post: prints the values stored in the SparseMatrix matrix.
-*/
-ostream &operator << (ostream &out, SparseMatrix matrix){
-    for(int i=0; i < matrix.numRows; i++){
-        out << matrix[i];
-        if(i+1 < matrix.numRows)//Don't print a newline after the whole sparsematrix
-            out << endl;
+    struct Row {
+        vector<Index> cols;
+        vector<T> values;
+    };
+    
+    struct Page {
+        const Row *rows[pageRows];
+        Page(){
+            fill(rows, rows + pageRows, nullptr);
+        }
+    };
+    
+    struct Version {
+        uint64_t number;
+        size_t nonZeros;
+        vector<Page *> pages;
+        Version() : number(0), nonZeros(0){}
+    };
+    
+    struct Write {
+        Index row;
+        Index col;
+        T value;
+        bool remove;
+        Write(Index r, Index c, T v, bool e) : row(r), col(c), value(v), remove(e){}
+    };
+    
+    struct Retired { //What one publish replaced, freed once every snapshot announces a later epoch
+        uint64_t epoch;
+        const Version *version;
+        vector<Page *> pages;
+        vector<const Row *> rows;
+    };
+    
+    struct Slot {
+        atomic<uint64_t> epoch; //Epoch announced by the snapshot holding the slot, 0 when free
+        char padding[64];       //Keeps neighbouring slots off one cache line
+        Slot() : epoch(0){}
+    };
+    
+    Index numRows;
+    Index numCols;
+    atomic<const Version *> root;
+    atomic<uint64_t> epoch;
+    vector<unique_ptr<Slot> > slots;
+    mutex writeLock; //Guards staged and retired
+    vector<Write> staged;
+    vector<Retired> retired;
+    
+    /*
+    Post: the slots snapshots announce their epochs in.
+    */
+    void newSlots(){
+        size_t count = max((size_t)64, (size_t)thread::hardware_concurrency() * 4);
+        for(size_t i=0; i < count; i++){
+            slots.push_back(unique_ptr<Slot>(new Slot()));
+        }
     }
-    return out;
-}
+    
+    /*
+    Pre:  staged[first, last) are the sorted writes to one row, whose current version is stored (or nullptr).
+    Post: returns a new version of the row with the writes applied.
+    */
+    Row * updatedRow(const Row *stored, size_t first, size_t last) const {
+        Row *changed = new Row();
+        size_t pos = 0, end = stored == nullptr ? 0 : stored->cols.size();
+        for(size_t i = first; i < last; i++){
+            const Write &write = staged[i];
+            for(; pos < end && stored->cols[pos] < write.col; pos++){
+                changed->cols.push_back(stored->cols[pos]);
+                changed->values.push_back(stored->values[pos]);
+            }
+            if(pos < end && stored->cols[pos] == write.col)
+                pos++; //Replaced or removed
+            if(i + 1 < last && staged[i+1].col == write.col)
+                continue; //A later write to the same position wins
+            if(!write.remove){
+                changed->cols.push_back(write.col);
+                changed->values.push_back(write.value);
+            }
+        }
+        for(; pos < end; pos++){
+            changed->cols.push_back(stored->cols[pos]);
+            changed->values.push_back(stored->values[pos]);
+        }
+        return changed;
+    }
+    
+    /*
+    Pre:  writeLock is held.
+    Post: every retired publish older than the oldest open snapshot is freed.
+    */
+    void reclaimLocked(){
+        uint64_t oldest = numeric_limits<uint64_t>::max();
+        for(size_t i=0; i < slots.size(); i++){
+            uint64_t announced = slots[i]->epoch.load();
+            if(announced != 0)
+                oldest = min(oldest, announced);
+        }
+        size_t kept = 0;
+        for(size_t i=0; i < retired.size(); i++){
+            if(retired[i].epoch < oldest)
+                release(retired[i]);
+            else if(kept++ != i) //Moving onto itself would empty the lists
+                retired[kept-1] = move(retired[i]);
+        }
+        retired.resize(kept);
+    }
+    
+    static void release(Retired &replaced){
+        for(size_t i=0; i < replaced.rows.size(); i++){
+            delete replaced.rows[i];
+        }
+        for(size_t i=0; i < replaced.pages.size(); i++){
+            delete replaced.pages[i];
+        }
+        delete replaced.version;
+    }
+    
+    /*
+    Post: returns a frozen matrix holding the rows of version.
+    */
+    Matrix copyOf(const Version &version) const {
+        typename Matrix::CompressedStorage storage;
+        storage.offsets.assign(numRows + 1, 0);
+        vector<Index> cols;
+        vector<T> values;
+        cols.reserve(version.nonZeros);
+        values.reserve(version.nonZeros);
+        for(Index row=0; row < numRows; row++){
+            const Row *stored = version.pages[row / pageRows]->rows[row % pageRows];
+            if(stored != nullptr){
+                cols.insert(cols.end(), stored->cols.begin(), stored->cols.end());
+                values.insert(values.end(), stored->values.begin(), stored->values.end());
+            }
+            storage.offsets[row+1] = cols.size();
+        }
+        storage.indices.assign(move(cols));
+        storage.values.assign(move(values));
+        return Matrix(numRows, numCols, move(storage));
+    }
+    
+    /*
+    Post: returns a number unique to the calling thread, so threads start looking for a free slot at different places.
+    */
+    static size_t threadSlot(){
+        static atomic<size_t> nextSlot(0);
+        static thread_local size_t slot = nextSlot++;
+        return slot;
+    }
+};
 
 #endif /* SparseMatrix_hpp */
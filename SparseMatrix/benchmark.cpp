@@ -0,0 +1,449 @@
+//
+//  benchmark.cpp
+//  SparseMatrix
+//
+//  Times the core SparseMatrix operations on generated matrices and prints the
+//  results as JSON, one object per (operation, matrix) pair.
+//
+//  Build and run from the repository root:
+//    g++ -std=c++11 -O2 -pthread SparseMatrix/benchmark.cpp -o benchmark
+//    ./benchmark > results.json          (full sweep)
+//    ./benchmark --quick > results.json  (smallest size of each generator only)
+//  Adding -DSPARSEMATRIX_INSTRUMENT also prints the library's counters and timers
+//  (see Instrumentation) summed over the whole run.
+//
+//  Every result holds the seconds one iteration took (the best of several runs),
+//  items and stored Elements processed per second, the peak resident memory and
+//  the number and size of heap allocations made per iteration.
+//
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <sys/resource.h>
+#include "SparseMatrix.hpp"
+using namespace std;
+
+
+//MARK: Allocation Counting
+/*
+Every heap allocation in the program goes through these, so the benchmark can report how many
+allocations an operation makes. Array, nothrow and sized forms all end up here.
+*/
+static atomic<size_t> allocationCount(0);
+static atomic<size_t> allocatedBytes(0);
+
+__attribute__((noinline)) void * operator new(size_t size){
+    allocationCount++;
+    allocatedBytes += size;
+    void *memory = malloc(size == 0 ? 1 : size);
+    if(memory == nullptr)
+        throw bad_alloc();
+    return memory;
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+
+//MARK: Peak Memory
+/*
+Starts a new peak resident memory measurement. Only Linux can reset the peak, so elsewhere the
+reported peak is the largest the process has been so far.
+*/
+static void resetPeakMemory(){
+#ifdef __linux__
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+    if(file != nullptr){
+        fputs("5", file);
+        fclose(file);
+    }
+#endif
+}
+
+/*
+Post: returns the peak resident memory in kilobytes since the last resetPeakMemory.
+*/
+static long peakMemoryKb(){
+#ifdef __linux__
+    FILE *file = fopen("/proc/self/status", "r");
+    if(file != nullptr){
+        char line[256];
+        long kb = -1;
+        while(fgets(line, sizeof(line), file) != nullptr){
+            if(sscanf(line, "VmHWM: %ld", &kb) == 1)
+                break;
+        }
+        fclose(file);
+        if(kb >= 0)
+            return kb;
+    }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; //Bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+
+//MARK: Generators
+/*
+A generated matrix: its size, its triplets in no particular order and a description of how it was made.
+*/
+struct Generated {
+    string generator;
+    string parameter;
+    int rows;
+    int cols;
+    vector<Triplet> triplets;
+};
+
+/*
+Post: returns an n x n matrix holding perRow Elements per row at uniformly random columns.
+*/
+static Generated uniformMatrix(int n, int perRow, unsigned seed){
+    Generated g;
+    g.generator = "uniform";
+    g.parameter = "perRow=" + to_string(perRow);
+    g.rows = g.cols = n;
+    mt19937_64 random(seed);
+    uniform_int_distribution<int> col(0, n - 1);
+    uniform_real_distribution<double> value(-1, 1);
+    for(int row=0; row < n; row++){
+        for(int i=0; i < perRow; i++){
+            g.triplets.push_back(Triplet(row, col(random), value(random)));
+        }
+    }
+    return g;
+}
+
+/*
+Post: returns an n x n matrix with every position within halfWidth of the diagonal set.
+*/
+static Generated bandedMatrix(int n, int halfWidth, unsigned seed){
+    Generated g;
+    g.generator = "banded";
+    g.parameter = "halfWidth=" + to_string(halfWidth);
+    g.rows = g.cols = n;
+    mt19937_64 random(seed);
+    uniform_real_distribution<double> value(-1, 1);
+    for(int row=0; row < n; row++){
+        for(int col = max(0, row - halfWidth); col <= min(n - 1, row + halfWidth); col++){
+            g.triplets.push_back(Triplet(row, col, value(random)));
+        }
+    }
+    return g;
+}
+
+/*
+Post: returns an n x n matrix of blockSize x blockSize blocks down the diagonal, each holding a
+      random quarter of its positions.
+*/
+static Generated blockDiagonalMatrix(int n, int blockSize, unsigned seed){
+    Generated g;
+    g.generator = "blockDiagonal";
+    g.parameter = "blockSize=" + to_string(blockSize);
+    g.rows = g.cols = n;
+    mt19937_64 random(seed);
+    uniform_real_distribution<double> value(-1, 1);
+    for(int start=0; start < n; start += blockSize){
+        int end = min(n, start + blockSize);
+        for(int row = start; row < end; row++){
+            for(int col = start; col < end; col++){
+                if(random() % 4 == 0)
+                    g.triplets.push_back(Triplet(row, col, value(random)));
+            }
+        }
+    }
+    return g;
+}
+
+/*
+Recursive matrix (R-MAT) generator: each Element picks one quadrant of the matrix at every level
+with probabilities 0.57, 0.19, 0.19 and 0.05, giving the power-law row and column lengths of real graphs.
+Post: returns a 2^scale x 2^scale matrix with edgeFactor * 2^scale Elements before duplicates are merged.
+*/
+static Generated rmatMatrix(int scale, int edgeFactor, unsigned seed){
+    Generated g;
+    g.generator = "rmat";
+    g.parameter = "edgeFactor=" + to_string(edgeFactor);
+    g.rows = g.cols = 1 << scale;
+    mt19937_64 random(seed);
+    uniform_real_distribution<double> unit(0, 1);
+    size_t count = (size_t)edgeFactor << scale;
+    for(size_t i=0; i < count; i++){
+        int row = 0, col = 0;
+        for(int level=0; level < scale; level++){
+            double p = unit(random);
+            row = row * 2 + (p >= 0.76);
+            col = col * 2 + ((p >= 0.57 && p < 0.76) || p >= 0.95);
+        }
+        g.triplets.push_back(Triplet(row, col, unit(random)));
+    }
+    return g;
+}
+
+
+//MARK: Measurement
+/*
+Runs setup and then operation until about a fifth of a second has passed (and at least three
+times), timing only operation.
+Post: returns the best time of one run of operation in seconds. allocations and bytes hold the
+      allocations made by operation on average per run.
+*/
+template <class Setup, class Operation>
+static double measure(Setup setup, Operation operation, double &allocations, double &bytes){
+    double best = 1e300;
+    double total = 0;
+    size_t runs = 0, allocationTotal = 0, byteTotal = 0;
+    while(runs < 3 || (total < 0.2 && runs < 1000)){
+        setup();
+        size_t allocationsBefore = allocationCount, bytesBefore = allocatedBytes;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        operation();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        allocationTotal += allocationCount - allocationsBefore;
+        byteTotal += allocatedBytes - bytesBefore;
+        best = min(best, seconds);
+        total += seconds;
+        runs++;
+    }
+    allocations = (double)allocationTotal / runs;
+    bytes = (double)byteTotal / runs;
+    return best;
+}
+
+static bool firstResult = true;
+
+/*
+Prints one result object. nnz is the number of Elements in the matrix, items the number of operations
+one run performs (inserts, reads, rows...) and processed the number of stored Elements one run works
+through, or zero when the operation only touches a few of them (nnzPerSecond is then null).
+*/
+template <class Setup, class Operation>
+static void benchmark(const string &name, const Generated &g, size_t nnz, size_t items, size_t processed,
+                      Setup setup, Operation operation){
+    resetPeakMemory();
+    double allocations = 0, bytes = 0;
+    double seconds = measure(setup, operation, allocations, bytes);
+    seconds = max(seconds, 1e-9);
+
+    cout << (firstResult ? "" : ",\n");
+    firstResult = false;
+    cout << "    {\"operation\": \"" << name << "\", \"generator\": \"" << g.generator << "\", \"parameter\": \""
+         << g.parameter << "\", \"rows\": " << g.rows << ", \"cols\": " << g.cols << ", \"nnz\": " << nnz
+         << ", \"seconds\": " << seconds << ", \"itemsPerSecond\": " << items / seconds
+         << ", \"nnzPerSecond\": ";
+    if(processed > 0)
+        cout << processed / seconds;
+    else
+        cout << "null";
+    cout << ", \"peakRssKb\": " << peakMemoryKb()
+         << ", \"allocations\": " << allocations << ", \"allocatedBytes\": " << bytes << "}";
+    cout.flush();
+}
+
+
+//MARK: Operations
+/*
+Times spmv on a BlockSparseMatrix of whichever block size visitBlocks converted the matrix to.
+*/
+struct BlockSpmv {
+    const Generated &g;
+    size_t nnz;
+    string name;
+
+    template <class Blocks>
+    void operator () (const Blocks &blocks) const {
+        vector<double> x(g.cols, 1.), y(g.rows);
+        benchmark(name, g, nnz, 1, nnz, []{}, [&]{ blocks.spmv(y.data(), x.data()); });
+    }
+};
+
+/*
+Runs every operation on one generated matrix.
+*/
+static void benchmarkMatrix(const Generated &g){
+    SparseMatrix frozen = SparseMatrix::fromTriplets(g.rows, g.cols, g.triplets.begin(), g.triplets.end());
+    size_t nnz = frozen.nonZeros();
+    SparseMatrix matrix = frozen;
+    matrix.thaw();
+    const SparseMatrix &readOnly = matrix;
+
+    mt19937_64 random(42);
+    const size_t numReads = 1 << 18;
+    vector<pair<int, int> > positions(numReads);
+    for(size_t i=0; i < numReads; i++){
+        positions[i] = make_pair((int)(random() % g.rows), (int)(random() % g.cols));
+    }
+    volatile double sink = 0; //Keeps the reads from being optimized away
+
+    SparseMatrix built;
+    benchmark("insert", g, nnz, g.triplets.size(), nnz, [&]{ built = SparseMatrix(g.rows, g.cols); }, [&]{
+        for(size_t i=0; i < g.triplets.size(); i++){
+            built[g.triplets[i].row][g.triplets[i].col] += g.triplets[i].value;
+        }
+    });
+
+    //A stream of updates in random order, written through [][] and through a DeltaMatrix
+    vector<Triplet> shuffled = g.triplets;
+    shuffle(shuffled.begin(), shuffled.end(), mt19937_64(7));
+    benchmark("insertShuffled", g, nnz, shuffled.size(), nnz, [&]{ built = SparseMatrix(g.rows, g.cols); }, [&]{
+        for(size_t i=0; i < shuffled.size(); i++){
+            built[shuffled[i].row][shuffled[i].col] += shuffled[i].value;
+        }
+    });
+
+    unique_ptr<DeltaMatrix> delta;
+    benchmark("insertDelta", g, nnz, shuffled.size(), nnz, [&]{ delta.reset(new DeltaMatrix(g.rows, g.cols, DuplicatePolicy::Sum)); }, [&]{
+        for(size_t i=0; i < shuffled.size(); i++){
+            delta->update(shuffled[i].row, shuffled[i].col, shuffled[i].value);
+        }
+        delta->merge();
+    });
+
+    benchmark("fromTriplets", g, nnz, g.triplets.size(), nnz, [&]{ built = SparseMatrix(); }, [&]{
+        built = SparseMatrix::fromTriplets(g.rows, g.cols, g.triplets.begin(), g.triplets.end());
+    });
+
+    benchmark("randomRead", g, nnz, numReads, 0, []{}, [&]{
+        double sum = 0;
+        for(size_t i=0; i < numReads; i++){
+            sum += readOnly[positions[i].first][positions[i].second];
+        }
+        sink = sum;
+    });
+
+    benchmark("randomReadFrozen", g, nnz, numReads, 0, []{}, [&]{
+        double sum = 0;
+        for(size_t i=0; i < numReads; i++){
+            sum += frozen.at(positions[i].first, positions[i].second);
+        }
+        sink = sum;
+    });
+
+    VersionedMatrix versioned(frozen);
+    benchmark("randomReadSnapshot", g, nnz, numReads, 0, []{}, [&]{ //A snapshot of its own for every read
+        double sum = 0;
+        for(size_t i=0; i < numReads; i++){
+            sum += versioned.snapshot().at(positions[i].first, positions[i].second);
+        }
+        sink = sum;
+    });
+
+    const size_t numWrites = 1024;
+    benchmark("publish", g, nnz, numWrites, numWrites, []{}, [&]{
+        for(size_t i=0; i < numWrites; i++){
+            versioned.set(positions[i].first, positions[i].second, 1.);
+        }
+        versioned.publish();
+    });
+
+    benchmark("getIth", g, nnz, numReads, 0, []{}, [&]{
+        double sum = 0;
+        for(size_t i=0; i < numReads; i++){
+            sum += matrix[positions[i].first].getIth(positions[i].second);
+        }
+        sink = sum;
+    });
+
+    benchmark("rowAdd", g, nnz, (size_t)g.rows, 2 * nnz, []{}, [&]{
+        for(int row=0; row < g.rows; row++){
+            ElementList sum = matrix[row] + matrix[(row + 1) % g.rows];
+        }
+    });
+
+    benchmark("rowSubtract", g, nnz, (size_t)g.rows, 2 * nnz, []{}, [&]{
+        for(int row=0; row < g.rows; row++){
+            ElementList difference = matrix[row] - matrix[(row + 1) % g.rows];
+        }
+    });
+
+    ElementList accumulator;
+    benchmark("rowAxpy", g, nnz, (size_t)g.rows, nnz, [&]{ accumulator = ElementList(g.cols); }, [&]{
+        for(int row=0; row < g.rows; row++){
+            accumulator.axpy(0.5, matrix[row]);
+        }
+    });
+
+    benchmark("add", g, nnz, 1, 2 * nnz, [&]{ built = SparseMatrix(); }, [&]{ built = matrix + matrix; });
+    benchmark("addFrozen", g, nnz, 1, 2 * nnz, [&]{ built = SparseMatrix(); }, [&]{ built = frozen + frozen; });
+
+    benchmark("transpose", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = matrix.tr(); });
+    benchmark("transposeFrozen", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = frozen.tr(); });
+
+    if(nnz <= (size_t)4 << 20){ //The product of the larger power-law matrices outgrows a test machine
+        benchmark("multiply", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = matrix * matrix; });
+        benchmark("multiplyFrozen", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = frozen * frozen; });
+
+        MultiplyPlan plan(frozen, frozen);
+        SparseMatrix planned = plan.newProduct();
+        benchmark("multiplyPlanned", g, nnz, 1, nnz, []{}, [&]{ plan.execute(frozen, frozen, planned); });
+        benchmark("multiplyMinPlus", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = frozen.multiplyOver<MinPlus<double> >(frozen); });
+        benchmark("multiplyOrAnd", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = frozen.multiplyOver<OrAnd<double> >(frozen); });
+    }
+    //Only the product's entries where the matrix itself has one, as in triangle counting
+    benchmark("multiplyMasked", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = frozen.maskedProduct(frozen, frozen); });
+
+    vector<double> x(g.cols, 1.), y(g.rows);
+    benchmark("spmv", g, nnz, 1, nnz, []{}, [&]{ frozen.spmv(y.data(), x.data()); });
+
+    vector<double> xPanel(g.cols * (size_t)32, 1.), yPanel(g.rows * (size_t)32); //Items are right-hand sides, against spmv's one
+    benchmark("spmm32", g, nnz, 32, 32 * nnz, []{}, [&]{ frozen.spmm(yPanel.data(), xPanel.data(), 32); });
+
+    BlockShape shape = frozen.detectBlockShape();
+    BlockSpmv blockSpmv = {g, nnz, "spmvBlocks" + to_string(shape.rows) + "x" + to_string(shape.cols)};
+    frozen.visitBlocks(blockSpmv);
+
+    SellMatrix<8> sell(frozen);
+    benchmark("spmvSell8", g, nnz, 1, nnz, []{}, [&]{ sell.spmv(y.data(), x.data()); });
+
+    Reordering reordering;
+    benchmark("reorderRcm", g, nnz, 1, nnz, [&]{ reordering = Reordering(); }, [&]{ reordering = frozen.reordered(); });
+    benchmark("spmvRcm", g, nnz, 1, nnz, []{}, [&]{ reordering.matrix.spmv(y.data(), x.data()); });
+
+    benchmark("copy", g, nnz, 1, nnz, [&]{ built = SparseMatrix(); }, [&]{ built = matrix; });
+
+    if((long long)g.rows * g.cols <= 4000000){ //Printing writes every zero, so only small matrices are printed
+        ostringstream out;
+        benchmark("print", g, nnz, 1, nnz, [&]{ out.str(""); }, [&]{ out << readOnly; });
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    bool quick = argc > 1 && string(argv[1]) == "--quick";
+    int sizes[] = {1000, 10000, 100000};
+    int scales[] = {10, 13, 16};
+    int numSizes = quick ? 1 : 3;
+
+    cout << "{\n  \"threads\": " << WorkerPool::shared().size() << ",\n  \"benchmarks\": [\n";
+    for(int i=0; i < numSizes; i++){
+        benchmarkMatrix(uniformMatrix(sizes[i], 4, 1));
+        benchmarkMatrix(uniformMatrix(sizes[i], 32, 2));
+        benchmarkMatrix(bandedMatrix(sizes[i], 2, 3));
+        benchmarkMatrix(bandedMatrix(sizes[i], 16, 4));
+        benchmarkMatrix(blockDiagonalMatrix(sizes[i], 32, 5));
+        benchmarkMatrix(rmatMatrix(scales[i], 8, 6));
+    }
+    cout << "\n  ]";
+    if(Instrumentation::enabled()) //Totals over the whole sweep, when built with -DSPARSEMATRIX_INSTRUMENT
+        cout << ",\n  \"instrumentation\": " << Instrumentation::snapshot();
+    cout << "\n}" << endl;
+    return 0;
+}
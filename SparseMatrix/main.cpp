@@ -62,16 +62,136 @@ int main() {
     else
         cout << "Failed Multiply Unit Test"<<endl;
     
+    if(sm.sparseMatrixMultFractionUnitTest())
+        cout << "Passed Multiply Fraction Unit Test"<<endl;
+    else
+        cout << "Failed Multiply Fraction Unit Test"<<endl;
+    
     if(sm.sparseMatrixEqualsUnitTest())
         cout << "Passed Equals Unit Test"<<endl;
     else
         cout << "Failed Equals Unit Test"<<endl;
     
+    if(sm.sparseMatrixMoveUnitTest())
+        cout << "Passed Move Unit Test"<<endl;
+    else
+        cout << "Failed Move Unit Test"<<endl;
+    
     if(sm.sparseMatrixTransposeUnitTest())
         cout << "Passed Transpose Unit Test"<<endl;
     else
         cout << "Failed Transpose Unit Test"<<endl;
     
+    if(sm.sparseMatrixTransposeTallUnitTest())
+        cout << "Passed Transpose Tall Unit Test"<<endl;
+    else
+        cout << "Failed Transpose Tall Unit Test"<<endl;
+    
+    if(sm.sparseMatrixFreezeUnitTest())
+        cout << "Passed Freeze Unit Test"<<endl;
+    else
+        cout << "Failed Freeze Unit Test"<<endl;
+    
+    if(sm.sparseMatrixSpmvUnitTest())
+        cout << "Passed Spmv Unit Test"<<endl;
+    else
+        cout << "Failed Spmv Unit Test"<<endl;
+    
+    if(sm.sparseMatrixPoolUnitTest())
+        cout << "Passed Pool Unit Test"<<endl;
+    else
+        cout << "Failed Pool Unit Test"<<endl;
+    
+    if(sm.sparseMatrixTripletsUnitTest())
+        cout << "Passed Triplets Unit Test"<<endl;
+    else
+        cout << "Failed Triplets Unit Test"<<endl;
+    
+    if(sm.sparseMatrixMatrixMarketUnitTest())
+        cout << "Passed Matrix Market Unit Test"<<endl;
+    else
+        cout << "Failed Matrix Market Unit Test"<<endl;
+    
+    if(sm.sparseMatrixBinaryUnitTest())
+        cout << "Passed Binary Unit Test"<<endl;
+    else
+        cout << "Failed Binary Unit Test"<<endl;
+    
+    if(sm.sparseMatrixParallelMultUnitTest())
+        cout << "Passed Parallel Mult Unit Test"<<endl;
+    else
+        cout << "Failed Parallel Mult Unit Test"<<endl;
+    
+    if(sm.sparseMatrixTypesUnitTest())
+        cout << "Passed Types Unit Test"<<endl;
+    else
+        cout << "Failed Types Unit Test"<<endl;
+    
+    if(sm.sparseMatrixAddUnitTest())
+        cout << "Passed Add Unit Test"<<endl;
+    else
+        cout << "Failed Add Unit Test"<<endl;
+    
+    if(sm.sparseMatrixExpressionUnitTest())
+        cout << "Passed Expression Unit Test"<<endl;
+    else
+        cout << "Failed Expression Unit Test"<<endl;
+    
+    if(sm.sparseMatrixBlockUnitTest())
+        cout << "Passed Block Unit Test"<<endl;
+    else
+        cout << "Failed Block Unit Test"<<endl;
+    
+    if(sm.sparseMatrixRowIndexUnitTest())
+        cout << "Passed Row Index Unit Test"<<endl;
+    else
+        cout << "Failed Row Index Unit Test"<<endl;
+    
+    if(sm.sparseMatrixInstrumentationUnitTest())
+        cout << "Passed Instrumentation Unit Test"<<endl;
+    else
+        cout << "Failed Instrumentation Unit Test"<<endl;
+    
+    if(sm.sparseMatrixSellUnitTest())
+        cout << "Passed Sell Unit Test"<<endl;
+    else
+        cout << "Failed Sell Unit Test"<<endl;
+    
+    if(sm.sparseMatrixReorderUnitTest())
+        cout << "Passed Reorder Unit Test"<<endl;
+    else
+        cout << "Failed Reorder Unit Test"<<endl;
+    
+    if(sm.sparseMatrixMultiplyPlanUnitTest())
+        cout << "Passed Multiply Plan Unit Test"<<endl;
+    else
+        cout << "Failed Multiply Plan Unit Test"<<endl;
+    
+    if(sm.sparseMatrixDeltaUnitTest())
+        cout << "Passed Delta Unit Test"<<endl;
+    else
+        cout << "Failed Delta Unit Test"<<endl;
+    
+    if(sm.sparseMatrixVersionedUnitTest())
+        cout << "Passed Versioned Unit Test"<<endl;
+    else
+        cout << "Failed Versioned Unit Test"<<endl;
+    
+    if(sm.sparseMatrixMaskedUnitTest())
+        cout << "Passed Masked Unit Test"<<endl;
+    else
+        cout << "Failed Masked Unit Test"<<endl;
+    
+    if(sm.sparseMatrixSemiringUnitTest())
+        cout << "Passed Semiring Unit Test"<<endl;
+    else
+        cout << "Failed Semiring Unit Test"<<endl;
+    
+    if(sm.sparseMatrixSpmmUnitTest())
+        cout << "Passed Spmm Unit Test"<<endl;
+    else
+        cout << "Failed Spmm Unit Test"<<endl;
+    
     cout << "_______________________"<<endl;
     
     